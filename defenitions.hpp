@@ -54,17 +54,58 @@ typedef uint64_t (*generator_function) (uint8_t, bool, uint64_t, uint64_t);
 #define AUTO_KNIGHT         bit_boards[W_KNIGHT + 6 * is_black]
 #define AUTO_PAWN           bit_boards[W_PAWN + 6 * is_black]
 
-// Min and max eval score for alpha beta pruning.
-#define MAX_EVAL    100.f
-#define MIN_EVAL    -100.f
+// Min and max eval score for alpha beta pruning, in centipawns. Mate scores lie just within.
+#define MAX_EVAL    32001
+#define MIN_EVAL    -32001
 
 // Transposition table entry data flags.
 #define hashfEXACT  0
 #define hashfALPHA  1
 #define hashfBETA   2
 
-// Table size.
-#define hash_table_size 0x2000000
+// Default transposition table size in MB. The bucket count is rounded down to a power of two.
+#define HASH_TABLE_MB 64
+
+// Huge page size. Tables of at least this size are aligned to it, so the kernel can back them with huge pages.
+const uint64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Transposition table replacement. A search is one generation, every generation an entry is old counts as TT_AGE_WEIGHT plies
+// less depth. An entry of the running search is only overwritten by a shallower bound of the same position
+// if it is at most TT_KEEP_DEPTH plies deeper.
+const int TT_GENERATION_MASK = 0x3F;
+const int TT_AGE_WEIGHT = 8;
+const int TT_KEEP_DEPTH = 3;
+
+// Transposition table file format. Bump the version when the entry layout or the zobrist keys change.
+#define TT_FILE_MAGIC "TRANSTB\0"
+#define TT_FILE_VERSION 1
+
+// Shared memory transposition table. The creator of a segment marks the header ready with this value,
+// other processes wait at most TT_SHARED_WAIT_MS for that.
+#define TT_SHARED_READY 0x54545348
+#define TT_SHARED_WAIT_MS 2000
+
+// Entries of the pawn hash table of every search thread, a power of two.
+#define PAWN_HASH_SIZE 16384
+
+// Entries of the material hash table of every search thread, a power of two.
+#define MATERIAL_HASH_SIZE 8192
+
+// Material key: the count of every piece in 4 bits, the count of piece p at bit 4 * p.
+#define MATERIAL_KEY_UNIT(piece) (1ULL << (4 * (piece)))
+
+// Default perft table size in MB.
+#define PERFT_TABLE_MB 64
+
+// Perft cache file format. Bump the version when the entry layout or the zobrist keys change.
+#define PERFT_FILE_MAGIC "PERFTTB\0"
+#define PERFT_FILE_VERSION 1
+
+// Default perft cache file size in MB.
+#define PERFT_CACHE_MB 1024
+
+// Seed of the zobrist keys. Fixed, so keys stored in files stay valid between runs.
+#define ZOBRIST_SEED 0x9E3779B97F4A7C15ULL
 
 #define EN_PASSANT_LEFT  0b10000000
 #define EN_PASSANT_RIGHT 0b01000000
@@ -95,9 +136,118 @@ const float PAWN_VALUE = 1.f;
 
 const int PERFT_DEPTH = 8;
 
-// Avoid collissions by only hashing and checking at nodes that are worth hashing.
-const int MAX_HASH_DEPTH = 4;
-const int MIN_HASH_DEPTH = 2;
+// Default depth for the perft suite.
+const int PERFT_SUITE_DEPTH = 5;
+
+// Ply at which the parallel perft splits the tree into tasks.
+const int PERFT_SPLIT_DEPTH = 2;
+
+// Perft only hashes nodes with at least this many plies left, smaller subtrees are cheaper to count than to hash.
+const int PERFT_MIN_HASH_DEPTH = 2;
+
+// Ply at which the distributed perft splits the tree into jobs. Jobs are sent to other processes, so they are bigger.
+const int DISTRIBUTED_PERFT_SPLIT_DEPTH = 3;
+
+// A job that kills this many workers stops the distributed perft.
+const int DISTRIBUTED_PERFT_ATTEMPTS = 3;
+
+// Plies the FEN test walks from every input position, and how often it reloads all of them for the benchmark.
+const int FEN_TEST_PLIES = 2;
+const int FEN_TEST_REPEAT = 20;
+
+// Move ordering priorities, lower is searched first. Captures subtract their MVV-LVA score, killers add their slot.
+const int PRIORITY_PV_MOVE = 0;
+const int PRIORITY_HASH_MOVE = 1;
+const int PRIORITY_CAPTURE = 200;
+const int PRIORITY_KILLER = 300;
+const int PRIORITY_QUIET = 400;
+
+// MVV-LVA: value of the captured piece and rank of the capturing piece, per piece type (K Q R B N P).
+const int MVV_LVA_VICTIM[6] = {0, 9, 5, 3, 3, 1};
+const int MVV_LVA_ATTACKER[6] = {6, 5, 4, 3, 2, 1};
+
+// Static exchange evaluation piece values in centipawns, per piece type (K Q R B N P).
+// The king is worth more than everything else together, so it is only ever used as the last attacker.
+const int SEE_VALUE[6] = {20000, 900, 500, 300, 300, 100};
+
+// History heuristic. Scores stay within +-HISTORY_MAX, a cutoff at depth d gives a bonus of d * d * HISTORY_BONUS_SCALE.
+const int HISTORY_MAX = 16384;
+const int HISTORY_BONUS_SCALE = 32;
+const int HISTORY_BONUS_MAX = 1536;
+
+// Captures that lose material by static exchange evaluation are searched after all quiet moves,
+// whose priorities range from PRIORITY_QUIET to PRIORITY_QUIET + 6 * HISTORY_MAX.
+const int PRIORITY_LOSING_CAPTURE = PRIORITY_QUIET + 6 * HISTORY_MAX + 200;
+
+// Quiescence search skips captures that can not reach alpha even when they win this many centipawns more than the captured piece.
+const int DELTA_MARGIN = 200;
+
+// Null move pruning from this depth on. The pass is searched NULL_MOVE_REDUCTION + depth / NULL_MOVE_DEPTH_DIVISOR
+// plies shallower, plus one ply for every NULL_MOVE_EVAL_DIVISOR centipawns the evaluation is above beta, at most NULL_MOVE_EVAL_MAX.
+const int NULL_MOVE_MIN_DEPTH = 3;
+const int NULL_MOVE_REDUCTION = 3;
+const int NULL_MOVE_DEPTH_DIVISOR = 6;
+const int NULL_MOVE_EVAL_DIVISOR = 100;
+const int NULL_MOVE_EVAL_MAX = 2;
+// From this depth on a null move cutoff is verified, also with rooks or queens on the board.
+const int NULL_MOVE_VERIFY_DEPTH = 10;
+
+// Late move reductions of LMR_BASE + ln(depth) * ln(move number) / LMR_DIVISOR plies, from LMR_MIN_DEPTH on
+// and after the first LMR_MIN_MOVES moves. Later moves use the reduction of move LMR_MAX_MOVES - 1.
+const float LMR_BASE = 0.75f;
+const float LMR_DIVISOR = 2.25f;
+const int LMR_MIN_DEPTH = 3;
+const int LMR_MIN_MOVES = 3;
+const int LMR_MAX_MOVES = 64;
+
+// Aspiration windows from this depth on. The first window reaches ASPIRATION_WINDOW centipawns to both sides of the score
+// of the last iteration, and doubles every time the score falls outside.
+const int ASPIRATION_MIN_DEPTH = 4;
+const int ASPIRATION_WINDOW = 25;
+
+// Deepest iteration of a search without a depth limit, and the size of the per ply search arrays.
+const int MAX_SEARCH_DEPTH = 64;
+const int MAX_SEARCH_PLY = 128;
+// Capacity of a move list. The search keeps the moves of every ply of a line in one list, a position has at most 218.
+const int MOVE_LIST_SIZE = MAX_SEARCH_PLY * 256;
+
+// Being mated at ply n scores -MATE_SCORE + n, so shorter mates score better. Scores beyond MATE_BOUND are mates.
+const int MATE_SCORE = 32000;
+const int MATE_BOUND = MATE_SCORE - MAX_SEARCH_PLY;
+const int DRAW_SCORE = 0;
+
+// Nodes between two checks of the stop flag and the search limits. Must be a power of two.
+const int SEARCH_CHECK_NODES = 1024;
+
+// Range of the random time after which the stop latency test stops a search.
+const int STOP_TEST_MIN_MS = 20;
+const int STOP_TEST_MAX_MS = 300;
+
+// The transposition table stress test hammers this many buckets with a fixed set of keys,
+// so the threads keep writing and reading the same entries.
+const int TT_STRESS_BUCKETS = 4;
+const int TT_STRESS_KEYS = 256;
+const int TT_STRESS_SECONDS = 5;
+
+// Pawn structure terms in centipawns. Passed pawns get a bonus by rank, from the view of their own side.
+const int DOUBLED_PAWN_PENALTY = 15;
+const int ISOLATED_PAWN_PENALTY = 12;
+const int BACKWARD_PAWN_PENALTY = 8;
+const int PASSED_PAWN_BONUS[8] = {0, 5, 10, 20, 35, 60, 100, 0};
+
+// Material terms in centipawns. Knights gain and rooks lose a little value for every own pawn above five.
+const int BISHOP_PAIR_BONUS = 30;
+const int KNIGHT_PAWN_ADJUSTMENT = 6;
+const int ROOK_PAWN_ADJUSTMENT = 12;
+
+// Endgame of a bare king against mating material. The weak king is driven to the edge and the strong king closer.
+const int KXK_EDGE_BONUS = 20;
+const int KXK_KING_DISTANCE_BONUS = 10;
+
+// Time manager. Without a move time we plan for this many moves left on the clock, use most of the increment,
+// and keep a margin for the overhead of sending the move.
+const int TIME_MOVES_TO_GO = 30;
+const int TIME_OVERHEAD_MS = 30;
 
 // Square bonus for each piece.
 const float PAWN_BONUS[64] = 
@@ -0,0 +1,432 @@
+#include "engine.hpp"
+
+// ==============================================================================================
+
+// Distributed perft. A coordinator splits the tree into FEN + depth jobs and hands them to worker processes.
+// Protocol, one job or result per line over the worker's stdin and stdout:
+//   coordinator -> worker: <job id> <plies left> <fen>
+//   worker -> coordinator: <job id> <nodes>
+// A worker exits when its input is closed. A job of a worker that dies is queued again.
+
+// ==============================================================================================
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <deque>
+#include <cstdio>
+
+// Subtree sent to a worker.
+typedef struct
+{
+    int root_move_index;
+    int depth;
+    std::string fen;
+    uint64_t nodes;
+    bool done;
+    int attempts;
+} distributed_job;
+
+// Coordinator side of a worker process.
+typedef struct
+{
+    pid_t pid;
+    int to_worker;
+    int from_worker;
+    int job;
+    std::string buffer;
+} worker_process;
+
+// ==============================================================================================
+
+// Start a worker process. Without a command the coordinator forks and the child answers jobs itself,
+// otherwise the command runs through /bin/sh with the pipes as stdin and stdout.
+static bool start_worker_process(Engine* engine, std::vector<worker_process>& workers, int worker, const std::string& worker_command)
+{
+    int job_pipe[2];
+    int result_pipe[2];
+    if(pipe(job_pipe) != 0)
+        return false;
+    if(pipe(result_pipe) != 0)
+    {
+        close(job_pipe[0]);
+        close(job_pipe[1]);
+        return false;
+    }
+
+    pid_t pid = fork();
+    if(pid < 0)
+    {
+        close(job_pipe[0]);
+        close(job_pipe[1]);
+        close(result_pipe[0]);
+        close(result_pipe[1]);
+        return false;
+    }
+
+    if(pid == 0)
+    {
+        // Drop the pipes of the other workers, otherwise they never see their input close.
+        for(int other = 0; other < int(workers.size()); other++)
+        {
+            if(other == worker || workers[other].pid <= 0)
+                continue;
+            close(workers[other].to_worker);
+            close(workers[other].from_worker);
+        }
+        close(job_pipe[1]);
+        close(result_pipe[0]);
+
+        if(worker_command.empty())
+        {
+            engine->run_perft_worker(job_pipe[0], result_pipe[1]);
+            _exit(0);
+        }
+
+        dup2(job_pipe[0], STDIN_FILENO);
+        dup2(result_pipe[1], STDOUT_FILENO);
+        close(job_pipe[0]);
+        close(result_pipe[1]);
+        execl("/bin/sh", "sh", "-c", worker_command.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+
+    close(job_pipe[0]);
+    close(result_pipe[1]);
+    workers[worker] = {pid, job_pipe[1], result_pipe[0], -1, std::string()};
+    return true;
+}
+
+// ==============================================================================================
+
+// Close the pipes of a worker and wait for it to exit.
+static void stop_worker_process(worker_process& worker)
+{
+    close(worker.to_worker);
+    close(worker.from_worker);
+    waitpid(worker.pid, nullptr, 0);
+    worker.pid = -1;
+}
+
+// ==============================================================================================
+
+// Write a complete buffer to a pipe. Returns false if the reader is gone.
+static bool write_all(int fd, const std::string& text)
+{
+    size_t written = 0;
+    while(written < text.size())
+    {
+        ssize_t result = write(fd, text.data() + written, text.size() - written);
+        if(result <= 0)
+            return false;
+        written += result;
+    }
+    return true;
+}
+
+// ==============================================================================================
+
+// Answer perft jobs from input_fd on output_fd until the input closes.
+void Engine::run_perft_worker(int input_fd, int output_fd)
+{
+    FILE* input = fdopen(input_fd, "r");
+    FILE* output = fdopen(output_fd, "w");
+    if(input == nullptr || output == nullptr)
+        return;
+
+    std::unique_ptr<moves> possible_moves = std::make_unique<moves>();
+    char line[256];
+    while(std::fgets(line, sizeof(line), input) != nullptr)
+    {
+        std::istringstream fields(line);
+        int job;
+        int depth;
+        std::string fen;
+        if(!(fields >> job >> depth) || !std::getline(fields >> std::ws, fen))
+            continue;
+
+        Position position = Position::from_fen(fen);
+        possible_moves->move_count = 0;
+        uint64_t key = hasher.calculate_zobrist_key(&position, !position.white_to_turn);
+        uint64_t nodes = depth == 0 ? 1 : perft_count(&position, depth, !position.white_to_turn, *possible_moves, key);
+
+        std::fprintf(output, "%d %llu\n", job, (unsigned long long)nodes);
+        std::fflush(output);
+    }
+
+    std::fclose(input);
+    std::fclose(output);
+}
+
+// ==============================================================================================
+
+// Perft split into FEN + depth jobs for worker processes. Finished jobs are appended to the journal file,
+// so a run that was interrupted continues where it stopped. Returns false if the run could not finish.
+bool Engine::do_distributed_perft_test(int depth, Position* position, int worker_count, int split_depth, const std::string& worker_command, const std::string& journal_file)
+{
+    auto start = std::chrono::steady_clock::now();
+    worker_count = std::max(worker_count, 1);
+
+    // Enumerate the subtrees like the parallel perft, then write each of them as FEN.
+    bool color_sign = !position->white_to_turn;
+    std::unique_ptr<moves> root_moves = std::make_unique<moves>();
+    root_moves->move_count = 0;
+    position->determine_moves(color_sign, *root_moves);
+
+    std::vector<distributed_job> jobs;
+    if(depth > 1)
+    {
+        split_depth = std::clamp(split_depth, 1, depth - 1);
+
+        std::vector<perft_task> tasks;
+        std::vector<Move> path;
+        std::unique_ptr<moves> split_moves = std::make_unique<moves>();
+        split_moves->move_count = 0;
+        for(int i = 0; i < root_moves->move_count; i++)
+        {
+            path.assign(1, root_moves->moves[i]);
+            position->do_move(&root_moves->moves[i]);
+            make_perft_tasks(position, depth - 1, split_depth - 1, !color_sign, *split_moves, path, i, tasks);
+            position->undo_move(&root_moves->moves[i]);
+        }
+
+        for(perft_task& task : tasks)
+        {
+            Position job_position(*position);
+            for(Move& move : task.path)
+                job_position.do_move(&move);
+            jobs.push_back({task.root_move_index, task.depth, job_position.to_fen(), 0, false, 0});
+        }
+    }
+    else
+    {
+        for(int i = 0; i < root_moves->move_count; i++)
+            jobs.push_back({i, 0, std::string(), 1, true, 0});
+    }
+
+    // Read the results of an earlier run of the same perft from the journal.
+    int resumed_count = 0;
+    uint64_t resumed_nodes = 0;
+    FILE* journal = nullptr;
+    if(!journal_file.empty())
+    {
+        std::string header = "perft " + std::to_string(depth) + " " + std::to_string(split_depth) + " " + position->to_fen();
+        std::ifstream previous(journal_file);
+        std::string line;
+        bool resume = std::getline(previous, line) && line == header;
+        while(resume && std::getline(previous, line))
+        {
+            std::istringstream fields(line);
+            int job;
+            uint64_t nodes;
+            if(!(fields >> job >> nodes) || job < 0 || job >= int(jobs.size()) || jobs[job].done)
+                continue;
+            jobs[job].nodes = nodes;
+            jobs[job].done = true;
+            resumed_count++;
+            resumed_nodes += nodes;
+        }
+        previous.close();
+
+        journal = std::fopen(journal_file.c_str(), resume ? "a" : "w");
+        if(journal == nullptr)
+        {
+            std::cout << "Could not open perft journal: " << journal_file << '\n';
+            return false;
+        }
+        if(!resume)
+            std::fprintf(journal, "%s\n", header.c_str());
+        std::fflush(journal);
+    }
+
+    std::deque<int> pending_jobs;
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        if(!jobs[i].done)
+            pending_jobs.push_back(i);
+    }
+
+    // A dead worker must not kill the coordinator when we write to it.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<worker_process> workers(worker_count, {-1, -1, -1, -1, std::string()});
+    int worker_restarts = 0;
+    int running_jobs = 0;
+    bool failed = false;
+
+    for(int worker = 0; worker < worker_count && !pending_jobs.empty(); worker++)
+    {
+        if(!start_worker_process(this, workers, worker, worker_command))
+        {
+            std::cout << "Could not start worker " << worker << '\n';
+            failed = true;
+            break;
+        }
+    }
+
+    // Put the job of a dead worker back in front of the queue and start a new worker in its place.
+    auto restart_worker = [&](int worker)
+    {
+        int job = workers[worker].job;
+        stop_worker_process(workers[worker]);
+        if(job >= 0)
+        {
+            running_jobs--;
+            jobs[job].attempts++;
+            std::cout << "Worker " << worker << " died, job " << job << " is queued again" << '\n';
+            if(jobs[job].attempts >= DISTRIBUTED_PERFT_ATTEMPTS)
+            {
+                std::cout << "Job " << job << " failed " << jobs[job].attempts << " times: " << jobs[job].fen << '\n';
+                failed = true;
+                return;
+            }
+            pending_jobs.push_front(job);
+        }
+        worker_restarts++;
+        if(!start_worker_process(this, workers, worker, worker_command))
+        {
+            std::cout << "Could not restart worker " << worker << '\n';
+            failed = true;
+        }
+    };
+
+    while(!failed && (!pending_jobs.empty() || running_jobs > 0))
+    {
+        // Hand out jobs to idle workers.
+        for(int worker = 0; worker < worker_count && !failed; worker++)
+        {
+            if(workers[worker].pid <= 0 || workers[worker].job >= 0 || pending_jobs.empty())
+                continue;
+
+            int job = pending_jobs.front();
+            pending_jobs.pop_front();
+            workers[worker].job = job;
+            running_jobs++;
+
+            std::string request = std::to_string(job) + " " + std::to_string(jobs[job].depth) + " " + jobs[job].fen + "\n";
+            if(!write_all(workers[worker].to_worker, request))
+                restart_worker(worker);
+        }
+        if(failed)
+            break;
+
+        // Wait for results.
+        std::vector<pollfd> poll_fds;
+        std::vector<int> poll_workers;
+        for(int worker = 0; worker < worker_count; worker++)
+        {
+            if(workers[worker].pid <= 0 || workers[worker].job < 0)
+                continue;
+            poll_fds.push_back({workers[worker].from_worker, POLLIN, 0});
+            poll_workers.push_back(worker);
+        }
+        if(poll_fds.empty())
+            continue;
+        if(poll(poll_fds.data(), poll_fds.size(), -1) < 0)
+            continue;
+
+        for(size_t i = 0; i < poll_fds.size() && !failed; i++)
+        {
+            if(poll_fds[i].revents == 0)
+                continue;
+
+            int worker = poll_workers[i];
+            char buffer[256];
+            ssize_t length = read(workers[worker].from_worker, buffer, sizeof(buffer));
+            if(length <= 0)
+            {
+                restart_worker(worker);
+                continue;
+            }
+            workers[worker].buffer.append(buffer, length);
+
+            // Read every complete result line.
+            size_t line_end;
+            while((line_end = workers[worker].buffer.find('\n')) != std::string::npos)
+            {
+                std::istringstream fields(workers[worker].buffer.substr(0, line_end));
+                workers[worker].buffer.erase(0, line_end + 1);
+
+                int job;
+                uint64_t nodes;
+                if(!(fields >> job >> nodes) || job != workers[worker].job)
+                    continue;
+
+                jobs[job].nodes = nodes;
+                jobs[job].done = true;
+                workers[worker].job = -1;
+                running_jobs--;
+
+                if(journal != nullptr)
+                {
+                    std::fprintf(journal, "%d %llu\n", job, (unsigned long long)nodes);
+                    std::fflush(journal);
+                }
+            }
+        }
+    }
+
+    // Closing the job pipes ends the workers.
+    for(worker_process& worker : workers)
+    {
+        if(worker.pid > 0)
+            stop_worker_process(worker);
+    }
+    if(journal != nullptr)
+        std::fclose(journal);
+
+    if(failed)
+    {
+        std::cout << "Distributed perft did not finish, finished jobs are kept in the journal" << '\n';
+        return false;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double time_cost = std::chrono::duration<double>(end - start).count();
+
+    // Merge the results per root move.
+    std::vector<uint64_t> root_nodes(root_moves->move_count, 0);
+    uint64_t nodes = 0;
+    for(distributed_job& job : jobs)
+    {
+        root_nodes[job.root_move_index] += job.nodes;
+        nodes += job.nodes;
+    }
+
+    // Move count for debugging, in move generation order.
+    for(int i = 0; i < root_moves->move_count; i++)
+    {
+        std::cout << root_moves->moves[i].to_string() << ": " << root_nodes[i] << '\n';
+    }
+
+    std::cout << "Depth: " << depth << '\n';
+    std::cout << "Workers: " << worker_count << " Jobs: " << jobs.size() <<
+        " Resumed: " << resumed_count << " Worker restarts: " << worker_restarts << '\n';
+    std::cout << "PERFT results: \nNodes evaluated: " << nodes << " (resumed from the journal: " << resumed_nodes << ")" <<
+        "\nTime cost: " << time_cost << '\n';
+    // Only the nodes counted in this run took the time.
+    std::cout << "Nodes per second " << (nodes - resumed_nodes) / time_cost / 1e6 << " Million nodes per second" << '\n';
+    std::cout << "================================================================================ \n";
+    return true;
+}
+
+// ==============================================================================================
+
+#else
+
+// Worker processes are started with fork, which Windows does not have.
+void Engine::run_perft_worker(int input_fd, int output_fd)
+{
+    std::cout << "Distributed perft needs a POSIX system" << '\n';
+}
+
+bool Engine::do_distributed_perft_test(int depth, Position* position, int worker_count, int split_depth, const std::string& worker_command, const std::string& journal_file)
+{
+    std::cout << "Distributed perft needs a POSIX system" << '\n';
+    return false;
+}
+
+#endif
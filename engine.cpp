@@ -6,6 +6,36 @@
 Engine::Engine()
 {
     hasher.init_zobrist_keys();
+
+    // Late move reductions grow with the logarithm of both the depth and the move number.
+    for(int depth = 1; depth <= MAX_SEARCH_DEPTH; depth++)
+    {
+        for(int move_number = 1; move_number < LMR_MAX_MOVES; move_number++)
+            late_move_reductions[depth][move_number] = int(LMR_BASE + std::log(depth) * std::log(move_number) / LMR_DIVISOR);
+    }
+}
+
+// ==============================================================================================
+
+// Resize the perft table.
+void Engine::set_perft_hash_mb(int size_mb)
+{
+    perft_table.resize(size_mb);
+}
+
+// ==============================================================================================
+
+// Keep the perft table in a memory mapped file. Counts stored by earlier runs over the same positions are reused.
+bool Engine::open_perft_cache(const std::string& file_name, int size_mb)
+{
+    if(!perft_table.map_file(file_name, size_mb, hasher.key_set_check()))
+    {
+        std::cout << "Could not map perft cache: " << file_name << '\n';
+        return false;
+    }
+
+    std::cout << "Perft cache: " << file_name << (perft_table.reused_persistent_file() ? " (reused)" : " (new)") << '\n';
+    return true;
 }
 
 // ==============================================================================================
@@ -13,13 +43,14 @@ Engine::Engine()
 // Call to perft test.
 void Engine::do_perft_test(int depth, Position* position, bool white_to_move)
 {
-    transposition_table.clear_table();
+    // Counts are stored per position and depth, so the counts of earlier runs stay valid and are not cleared.
     clock_t start = clock();
     currently_evaluating_perft_depth = depth;
-    moves possible_moves;
-    possible_moves.move_count = 0;
+    std::unique_ptr<moves> possible_moves = std::make_unique<moves>();
+    possible_moves->move_count = 0;
 
-    uint64_t nodes = perft_test(position, depth-1, !white_to_move, possible_moves);
+    uint64_t key = hasher.calculate_zobrist_key(position, !white_to_move);
+    uint64_t nodes = perft_test(position, depth-1, !white_to_move, *possible_moves, key);
     clock_t end = clock();
     double time_cost = double(end - start) / CLOCKS_PER_SEC;
     std::cout << "Depth: " << depth << '\n';
@@ -32,8 +63,23 @@ void Engine::do_perft_test(int depth, Position* position, bool white_to_move)
 // ==============================================================================================
 
 // Actual recursive perft test method.
-uint64_t Engine::perft_test(Position* position, int depth, bool color_sign, moves& possible_moves)
+uint64_t Engine::perft_test(Position* position, int depth, bool color_sign, moves& possible_moves, uint64_t key)
 {
+    bool is_root = depth == currently_evaluating_perft_depth-1;
+
+    // Read hash entry. The perft table is keyed by position and the number of plies left.
+    // The root is never read, so the divide output is always printed.
+    bool use_hash = depth + 1 >= PERFT_MIN_HASH_DEPTH && !is_root;
+    if(use_hash)
+    {
+        uint64_t entry_node_count;
+        if(perft_table.get_entry_nodes(depth + 1, key, entry_node_count))
+        {
+            // Position was already evaluated in a different order.
+            return entry_node_count;
+        }
+    }
+
     // Determine possible moves.
     int last_possible_count = possible_moves.move_count;
     position->determine_moves(color_sign, possible_moves);
@@ -45,7 +91,7 @@ uint64_t Engine::perft_test(Position* position, int depth, bool color_sign, move
         for(int i = last_possible_count; i < possible_moves.move_count; i++)
         {
             // Move count for debugging.
-            if(depth == currently_evaluating_perft_depth-1)
+            if(is_root)
             {
                 std::string move_string = possible_moves.moves[i].to_string();
                 std::cout << move_string << ": " << 1 << '\n';
@@ -60,45 +106,38 @@ uint64_t Engine::perft_test(Position* position, int depth, bool color_sign, move
         return move_count;
     }
 
-    uint64_t key;
-    // Make hash entries of position.
-    if((currently_evaluating_perft_depth - depth) <= MAX_HASH_DEPTH)
-    {
-        key = hasher.calculate_zobrist_key(position, color_sign);
-        uint64_t entry_node_count = transposition_table.get_entry_nodes(depth, key);
-        // Read hash entry.
-        if(entry_node_count != no_hash_entry)
-        {
-            // Position wes already evaluated in a different order.
-            possible_moves.move_count -= move_count;
-            return entry_node_count;
-        }
-    }
-
     for(int i = last_possible_count; i < possible_moves.move_count; i++)
     {
         // Do move.
         int move_index = i;
         
         position->do_move(&possible_moves.moves[move_index]);
+        // Update the key and start loading its bucket while the child generates its moves.
+        uint64_t child_key = key;
+        if(depth >= PERFT_MIN_HASH_DEPTH)
+        {
+            hasher.update_zobrist_hash(&possible_moves.moves[move_index], position, child_key);
+            perft_table.prefetch(child_key);
+        }
         // Recursive call.
-        uint64_t nodes_found = perft_test(position, depth-1, !color_sign, possible_moves);
+        uint64_t nodes_found = perft_test(position, depth-1, !color_sign, possible_moves, child_key);
         nodes += nodes_found;
         // Undo move.
 
         position->undo_move(&possible_moves.moves[move_index]);
 
         // Move count for debugging.
-        if(depth == currently_evaluating_perft_depth-1)
+        if(is_root)
         {
             std::string move_string = possible_moves.moves[move_index].to_string();
             std::cout << move_string << ": " << nodes_found << '\n';
         }
-
-        // Insert hash key.
-        if((currently_evaluating_perft_depth - depth) <= MAX_HASH_DEPTH && (currently_evaluating_perft_depth - depth) >= MIN_HASH_DEPTH)
-            transposition_table.insert_hash(depth, 0, 0, key, nodes);
     }
+
+    // Insert hash key.
+    if(use_hash)
+        perft_table.insert_nodes(depth + 1, key, nodes);
+
     // Return result.
     possible_moves.move_count -= move_count;
     return nodes;
@@ -106,214 +145,1653 @@ uint64_t Engine::perft_test(Position* position, int depth, bool color_sign, move
 
 // ==============================================================================================
 
-// Function to return the best found move.
-void Engine::best_move(Position* position, bool color_sign, int depth, Move& best_move)
+// Call to parallel perft test. Prints the same divide output as the single threaded test.
+void Engine::do_parallel_perft_test(int depth, Position* position, bool white_to_move, int thread_count, int split_depth)
 {
-    // For analysis.
-    int count = 0;
-    clock_t timer = clock();
-
-    // Initialize
-    int alpha = -100;
-    int beta = 100;
-    float score = 0.f;
-    
-    Move best_found;
-    moves possible_moves;
-    possible_moves.move_count = 0;
+    // Counts are stored per position and depth, so the counts of earlier runs stay valid and are not cleared.
+    std::unique_ptr<moves> root_moves = std::make_unique<moves>();
+    std::vector<uint64_t> root_nodes;
 
-    // Find best move.
-    score = search(depth, alpha, beta, count, position, best_found, true, !color_sign, 0, possible_moves);
+    // Wall time, clock() would add up the time of all threads.
+    auto start = std::chrono::steady_clock::now();
+    uint64_t nodes = parallel_perft(position, depth, white_to_move, thread_count, split_depth, *root_moves, root_nodes);
+    auto end = std::chrono::steady_clock::now();
+    double time_cost = std::chrono::duration<double>(end - start).count();
 
-    // Chech if engine was stopped due to time.
-    if(score == -999999)
+    // Move count for debugging, in move generation order.
+    for(int i = 0; i < root_moves->move_count; i++)
     {
-        return;
+        std::cout << root_moves->moves[i].to_string() << ": " << root_nodes[i] << '\n';
     }
 
-    // Analysis.
-    timer = clock() - timer;
-    float elapsed_seconds = static_cast<float>(timer) / CLOCKS_PER_SEC;
-    
-    // Output results.
-    std::cout << "Positions evaluated: " << count << "\n";
-    std::cout << "Score found was: " << score << "\n";
-    std::cout << "Average positions per second: " << count / elapsed_seconds << '\n';
-    std::cout << "Time taken: " << elapsed_seconds << "\n";
-
-    // Check if a valid move was found. 64 is the signal that none was found.
-    assert(best_found.start_location != 64);
-    best_move = Move(best_found);
-    return;
+    std::cout << "Depth: " << depth << '\n';
+    std::cout << "Threads: " << thread_count << '\n';
+    std::cout << "PERFT results: \nNodes evaluated: " << nodes <<
+        "\nTime cost: " << time_cost << '\n';
+    std::cout << "Nodes per second " << nodes / time_cost / 1e6 << " Million nodes per second" << '\n';
+    std::cout << "================================================================================ \n";
 }
 
-float Engine::search(int current_depth, int alpha, int beta, int& position_count, Position* position, Move& best_move, bool top_level, bool maximizing, int depth_limit, moves possible_moves)
-{
-    // Initialize ==================================================================================================================
+// ==============================================================================================
 
-    // Check if the time is up. If so, signal this to parent calls.
-    if(time_up)
-        return -999999;
+// Run the parallel perft with 1, 2, 4, ... threads up to max_threads and report NPS and scaling efficiency.
+void Engine::do_perft_scaling_test(int depth, Position* position, bool white_to_move, int max_threads, int split_depth)
+{
+    std::unique_ptr<moves> root_moves = std::make_unique<moves>();
+    std::vector<uint64_t> root_nodes;
+    double single_thread_nps = 0.0;
+    uint64_t expected_nodes = 0;
 
-    // Make hash entries of position.
-    int hashf = hashfALPHA;
-    uint64_t key = hasher.calculate_zobrist_key(position, !maximizing);
-    int entry_key_value = transposition_table.read_hash_entry(alpha, beta, current_depth, key);
+    std::cout << "Perft scaling test, depth: " << depth << ", split depth: " << split_depth << '\n';
 
-    // Read hash entry.
-    if(entry_key_value != no_hash_entry && !top_level)
+    for(int thread_count = 1; thread_count <= max_threads; )
     {
-        // Position wes already evaluated in a different order.
-        return entry_key_value;
+        // Start every run with an empty table, otherwise later runs only read back earlier results.
+        perft_table.clear_table(max_threads);
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t nodes = parallel_perft(position, depth, white_to_move, thread_count, split_depth, *root_moves, root_nodes);
+        auto end = std::chrono::steady_clock::now();
+        double time_cost = std::chrono::duration<double>(end - start).count();
+
+        double nps = nodes / time_cost;
+        if(thread_count == 1)
+        {
+            single_thread_nps = nps;
+            expected_nodes = nodes;
+        }
+        double speedup = nps / single_thread_nps;
+
+        std::cout << "Threads: " << thread_count << 
+            " Nodes: " << nodes << 
+            " Time cost: " << time_cost << 
+            " Million nodes per second: " << nps / 1000000 << 
+            " Speedup: " << speedup << 
+            " Efficiency: " << 100.0 * speedup / thread_count << "%" << '\n';
+
+        if(nodes != expected_nodes)
+            std::cout << "Node count differs from the single threaded run: " << expected_nodes << '\n';
+
+        // Double the threads, but always end with a run on max_threads.
+        if(thread_count < max_threads && thread_count * 2 > max_threads)
+            thread_count = max_threads;
+        else
+            thread_count *= 2;
     }
+    std::cout << "================================================================================ \n";
+}
 
-    // Count unique positions visited.
-    position_count++;
+// ==============================================================================================
 
-    // End of depth, evaluate position.
-    if(current_depth <= depth_limit)
+// Perft suite. Every line of the EPD file holds a FEN followed by the expected counts, e.g.
+// rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - ;D1 20 ;D2 400 ;D3 8902
+bool Engine::run_perft_suite(const std::string& file_name, int max_depth, int thread_count)
+{
+    std::ifstream file(file_name);
+    if(!file.is_open())
     {
-        int val = evaluate_position(position);
-        transposition_table.insert_hash(current_depth, val, hashfEXACT, key, 0);
-        return val;
+        std::cout << "Could not open perft suite: " << file_name << '\n';
+        return false;
     }
 
-    // Determine possible moves.
-    int last_possible_count = possible_moves.move_count;
-    position->determine_moves(!maximizing, possible_moves);
-    int move_count = possible_moves.move_count - last_possible_count;
+    std::unique_ptr<moves> root_moves = std::make_unique<moves>();
+    std::vector<uint64_t> root_nodes;
 
-    // No moves available means current player loses.
-    if(move_count == 0)
-        return maximizing ? -100 : 100;
+    int position_count = 0;
+    int failed_count = 0;
+    int unchecked_count = 0;
+    uint64_t total_nodes = 0;
+    double total_time = 0.0;
 
-    // sort_move_priority(possible_moves, position);
+    std::string line;
+    while(std::getline(file, line))
+    {
+        // Skip empty lines and comments.
+        if(line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#')
+            continue;
 
-    float eval = maximizing ? -100 : 100;
+        // Split the FEN from the expected counts.
+        std::istringstream fields(line);
+        std::string fen;
+        std::getline(fields, fen, ';');
 
-    Move local_best_move = possible_moves.moves[last_possible_count];
+        Position position;
+        try
+        {
+            position = Position::from_fen(fen);
+        }
+        catch(const std::invalid_argument& error)
+        {
+            std::cout << "Skipping invalid FEN: " << fen << " (" << error.what() << ")\n";
+            failed_count++;
+            continue;
+        }
 
-    // Actual search. ==================================================================================================================
-    
-    for(int i = last_possible_count; i < possible_moves.move_count; i++)
-    {
-        // Do move.
-        position->do_move(&possible_moves.moves[i]);
-        // Evaluate.
-        float score = search(current_depth - 1, alpha, beta, position_count, position, best_move, false, !maximizing, depth_limit, possible_moves);
-        // Undo.
-        position->undo_move(&possible_moves.moves[i]);
-        // Check if time is up.
-        if(score == -999999)
-            return -999999;
+        position_count++;
+        std::cout << "Position " << position_count << ": " << fen << '\n';
+
+        bool position_failed = false;
+        int checked_depths = 0;
+        uint64_t position_nodes = 0;
+        double position_time = 0.0;
 
-        // Evaluate found score and edit alpha, beta, and best move accordingly.
-        if (maximizing)
+        std::string expected;
+        while(std::getline(fields, expected, ';'))
         {
-            if (score >= eval)
+            // Empty fields, e.g. from a trailing ';', hold no count.
+            if(expected.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            // A count we can not read is a failure, otherwise a typo would silently drop the check.
+            int depth;
+            uint64_t expected_nodes;
+            char depth_letter;
+            std::istringstream expected_fields(expected);
+            if(!(expected_fields >> depth_letter >> depth >> expected_nodes) || depth_letter != 'D' || depth < 1
+                || !(expected_fields >> std::ws).eof())
             {
-                
-                eval = score;
-                if (eval > alpha)
-                {
-                    alpha = eval;
-                    local_best_move = Move(possible_moves.moves[i]);
-                    hashf = hashfEXACT;
-                }
+                std::cout << "  Invalid count: " << expected << " FAILED\n";
+                position_failed = true;
+                continue;
+            }
+            if(depth > max_depth)
+                continue;
+            checked_depths++;
+
+            // Clear the table, every count is checked and timed on its own.
+            perft_table.clear_table(thread_count);
+
+            auto start = std::chrono::steady_clock::now();
+            uint64_t nodes = parallel_perft(&position, depth, position.white_to_turn, thread_count, PERFT_SPLIT_DEPTH, *root_moves, root_nodes);
+            auto end = std::chrono::steady_clock::now();
+            double time_cost = std::chrono::duration<double>(end - start).count();
+
+            position_nodes += nodes;
+            position_time += time_cost;
+
+            std::cout << "  Depth " << depth << ": " << nodes;
+            if(nodes == expected_nodes)
+            {
+                std::cout << " OK";
             }
-            if (eval >= beta)
+            else
             {
-                transposition_table.insert_hash(current_depth, eval, hashfBETA, key, 0);
-                break;
+                std::cout << " expected " << expected_nodes << " FAILED";
+                position_failed = true;
             }
+            std::cout << " (" << time_cost << " s)\n";
         }
-        else
+
+        // A position without a count up to max_depth checked nothing, it is reported apart instead of passing.
+        if(checked_depths == 0 && !position_failed)
         {
-            if (score <= eval)
-            {
-                
-                eval = score;
-                if (eval < beta)
-                {
-                    beta = eval;
-                    local_best_move = Move(possible_moves.moves[i]);
-                    hashf = hashfEXACT;
-                }
-            }
-            if (eval <= alpha)
+            std::cout << "  No count up to depth " << max_depth << " UNCHECKED\n";
+            unchecked_count++;
+        }
+
+        failed_count += position_failed;
+        total_nodes += position_nodes;
+        total_time += position_time;
+
+        if(position_time > 0.0)
+        {
+            std::cout << "  Time cost: " << position_time << 
+                " Million nodes per second: " << position_nodes / position_time / 1000000 << '\n';
+        }
+    }
+
+    std::cout << "================================================================================ \n";
+    std::cout << "Positions: " << position_count << " Failed: " << failed_count << " Unchecked: " << unchecked_count << '\n';
+    std::cout << "Nodes evaluated: " << total_nodes << "\nTime cost: " << total_time << '\n';
+    if(total_time > 0.0)
+        std::cout << "Nodes per second " << total_nodes / total_time / 1000000 << " Million nodes per second" << '\n';
+    std::cout << "================================================================================ \n";
+
+    // A run that checked no position at all proves nothing.
+    return failed_count == 0 && unchecked_count < position_count;
+}
+
+// ==============================================================================================
+
+// Check that every FEN of a file and the positions a few plies after it survive a FEN round trip,
+// then time bulk loading all of them repeat times. Returns false if any round trip fails.
+bool Engine::run_fen_test(const std::string& file_name, int repeat)
+{
+    std::ifstream file(file_name);
+    if(!file.is_open())
+    {
+        std::cout << "Could not open FEN file: " << file_name << '\n';
+        return false;
+    }
+
+    std::unique_ptr<moves> possible_moves = std::make_unique<moves>();
+    std::vector<std::string> fens;
+    int failed_count = 0;
+
+    std::string line;
+    while(std::getline(file, line))
+    {
+        // Skip empty lines and comments.
+        if(line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#')
+            continue;
+
+        // EPD lines carry operations after the first ';'. Lines with the operation 'invalid' must be rejected.
+        size_t operations = line.find(';');
+        std::string fen = line.substr(0, operations);
+        bool expect_invalid = operations != std::string::npos && line.find("invalid", operations) != std::string::npos;
+
+        Position position;
+        try
+        {
+            position = Position::from_fen(fen);
+        }
+        catch(const std::invalid_argument& error)
+        {
+            if(expect_invalid)
             {
-                transposition_table.insert_hash(current_depth, eval, hashfALPHA, key, 0);
-                break;
+                std::cout << "Rejected: " << fen << " (" << error.what() << ")\n";
+                continue;
             }
+            std::cout << "Invalid FEN: " << fen << " (" << error.what() << ")\n";
+            failed_count++;
+            continue;
         }
+
+        if(expect_invalid)
+        {
+            std::cout << "Invalid FEN accepted FAILED: " << fen << '\n';
+            failed_count++;
+            continue;
+        }
+
+        if(!check_fen_round_trip(position, fen))
+            failed_count++;
+
+        // Walk a few plies, so castling, en passant and clock changes made by do_move get written too.
+        collect_fen_positions(&position, FEN_TEST_PLIES, *possible_moves, fens);
     }
 
-    if(top_level)
-        best_move = local_best_move;
+    // Round trip every collected position.
+    for(const std::string& fen : fens)
+    {
+        if(!check_fen_round_trip(Position::from_fen(fen), fen))
+            failed_count++;
+    }
 
-    transposition_table.insert_hash(current_depth, eval, hashf, key, 0);
-    return eval;
+    // Bulk load benchmark.
+    uint64_t loaded_count = 0;
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < repeat; i++)
+    {
+        for(const std::string& fen : fens)
+        {
+            Position position = Position::from_fen(fen);
+            // Keep the parser from being optimized away.
+            checksum += position.bit_boards[TOTAL] + position.halfmove_clock;
+            loaded_count++;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double time_cost = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "================================================================================ \n";
+    std::cout << "Positions: " << fens.size() << " Failed: " << failed_count << '\n';
+    std::cout << "Positions loaded: " << loaded_count << " (checksum " << checksum << ")\nTime cost: " << time_cost << '\n';
+    if(time_cost > 0.0)
+        std::cout << "Positions per second " << loaded_count / time_cost / 1000000 << " Million positions per second" << '\n';
+    std::cout << "================================================================================ \n";
+
+    return failed_count == 0;
 }
 
-// void Engine::sort_move_priority(std::vector<Move>& moves, Position* position)
-// {
-//     for (Move& move : moves)
-//     {
-//         // Set priority groups based on properties.
-//         if (move.is_capture(position)) 
-//         {
-//             move.priority_group = 1;
-//         } else if (move.is_check(position)) 
-//         {
-//             move.priority_group = 2;
-//         } else 
-//         {
-//             move.priority_group = 3;
-//         }
-//     }
-
-//     // Sort vector according to priority groups.
-//     std::sort(moves.begin(), moves.end(), [](const Move& a, const Move& b) {
-//         // Sort by priority_group first.
-//         if (a.priority_group != b.priority_group) {
-//             return a.priority_group < b.priority_group;
-//         }
-
-//         return a.evaluation > b.evaluation; 
-//     });
-// }
-
-
-float Engine::evaluate_piece_sum(Position* position, uint8_t color_sign)
-{
-    float points = 0.f;
-    for(int i = 0; i < 64; i++)
+// ==============================================================================================
+
+// Collect the FEN of the position and of every position up to plies_left moves after it.
+void Engine::collect_fen_positions(Position* position, int plies_left, moves& possible_moves, std::vector<std::string>& fens)
+{
+    fens.push_back(position->to_fen());
+    if(plies_left == 0)
+        return;
+
+    int last_possible_count = possible_moves.move_count;
+    position->determine_moves(!position->white_to_turn, possible_moves);
+
+    int move_count = possible_moves.move_count;
+    for(int i = last_possible_count; i < move_count; i++)
     {
-        uint8_t piece = position->get_piece(i);
-        
-        if(piece == EMPTY || piece > 5 != color_sign)
-            continue;
+        position->do_move(&possible_moves.moves[i]);
+        collect_fen_positions(position, plies_left - 1, possible_moves, fens);
+        position->undo_move(&possible_moves.moves[i]);
+    }
+    possible_moves.move_count = last_possible_count;
+}
+
+// ==============================================================================================
+
+// Write the position as FEN, read it back and compare. The written FEN has to read back to the same position
+// and write the same string again. The input only has to match in its normalized form, since an en passant
+// square without a capturing pawn is dropped.
+bool Engine::check_fen_round_trip(const Position& position, const std::string& fen)
+{
+    std::string written = position.to_fen();
+    Position loaded = Position::from_fen(written);
+
+    if(loaded == position && loaded.to_fen() == written)
+        return true;
+
+    std::cout << "FEN round trip FAILED: " << fen << "\n  written: " << written << "\n  read back: " << loaded.to_fen() << '\n';
+    return false;
+}
+
+// ==============================================================================================
+
+// Split the tree into subtrees at split_depth plies and count them on a work stealing pool.
+// Fills the node count of each root move and returns the total.
+uint64_t Engine::parallel_perft(Position* position, int depth, bool white_to_move, int thread_count, int split_depth, moves& root_moves, std::vector<uint64_t>& root_nodes)
+{
+    bool color_sign = !white_to_move;
+    root_moves.move_count = 0;
+    position->determine_moves(color_sign, root_moves);
+    root_nodes.assign(root_moves.move_count, 1);
+
+    if(depth <= 1)
+        return root_moves.move_count;
+
+    // Split at least one ply below the root and leave at least one ply to the workers.
+    split_depth = std::clamp(split_depth, 1, depth - 1);
+
+    // Enumerate the subtrees.
+    std::vector<perft_task> tasks;
+    std::vector<Move> path;
+    std::unique_ptr<moves> split_moves = std::make_unique<moves>();
+    split_moves->move_count = 0;
+    for(int i = 0; i < root_moves.move_count; i++)
+    {
+        path.assign(1, root_moves.moves[i]);
+        position->do_move(&root_moves.moves[i]);
+        make_perft_tasks(position, depth - 1, split_depth - 1, !color_sign, *split_moves, path, i, tasks);
+        position->undo_move(&root_moves.moves[i]);
+    }
+
+    // Every worker gets its own move arena.
+    std::vector<std::unique_ptr<moves>> worker_moves(thread_count);
+    for(std::unique_ptr<moves>& arena : worker_moves)
+        arena = std::make_unique<moves>();
+
+    std::vector<std::atomic<uint64_t>> subtree_nodes(root_moves.move_count);
+
+    WorkStealingPool pool(thread_count);
+    for(size_t i = 0; i < tasks.size(); i++)
+    {
+        perft_task* task = &tasks[i];
+        pool.push_task(i, [this, task, position, color_sign, &worker_moves, &subtree_nodes](int worker)
+        {
+            // Replay the path on a private copy of the root position.
+            Position worker_position(*position);
+            for(Move& move : task->path)
+                worker_position.do_move(&move);
+
+            moves& possible_moves = *worker_moves[worker];
+            possible_moves.move_count = 0;
 
-        points += get_piece_value(piece);
+            bool task_color_sign = color_sign ^ (task->path.size() % 2);
+            uint64_t key = hasher.calculate_zobrist_key(&worker_position, task_color_sign);
+            uint64_t nodes = perft_count(&worker_position, task->depth, task_color_sign, possible_moves, key);
+            subtree_nodes[task->root_move_index].fetch_add(nodes, std::memory_order_relaxed);
+        });
     }
+    pool.run();
 
-    return points;
+    uint64_t nodes = 0;
+    for(int i = 0; i < root_moves.move_count; i++)
+    {
+        root_nodes[i] = subtree_nodes[i].load(std::memory_order_relaxed);
+        nodes += root_nodes[i];
+    }
+    return nodes;
 }
 
-float Engine::evaluate_position(Position* position)
+// ==============================================================================================
+
+// Walk plies_left plies down from the current position and add a task for every position reached.
+void Engine::make_perft_tasks(Position* position, int depth, int plies_left, bool color_sign, moves& possible_moves, std::vector<Move>& path, int root_move_index, std::vector<perft_task>& tasks)
 {
-    float total_eval = 0.f;
+    if(plies_left == 0)
+    {
+        tasks.push_back({root_move_index, depth, path});
+        return;
+    }
 
-    // Calculate difference in pieced value.
-    float black_points = evaluate_piece_sum(position, 1) * piece_value_weight;
-    float white_points = evaluate_piece_sum(position, 0) * piece_value_weight;
+    int last_possible_count = possible_moves.move_count;
+    position->determine_moves(color_sign, possible_moves);
+    int move_count = possible_moves.move_count;
 
-    // Evaluate piece positions.
-    black_points += evaluate_square_bonus(position, 1) * square_bonus_weight;
-    white_points += evaluate_square_bonus(position, 0) * square_bonus_weight;
-    
-    total_eval = white_points - black_points;
-    return total_eval;
+    for(int i = last_possible_count; i < move_count; i++)
+    {
+        path.push_back(possible_moves.moves[i]);
+        position->do_move(&possible_moves.moves[i]);
+        make_perft_tasks(position, depth - 1, plies_left - 1, !color_sign, possible_moves, path, root_move_index, tasks);
+        position->undo_move(&possible_moves.moves[i]);
+        path.pop_back();
+    }
+
+    possible_moves.move_count = last_possible_count;
+}
+
+// ==============================================================================================
+
+// Perft worker recursion. Depth is the number of plies left, the last ply is counted in bulk.
+// The zobrist key of the position is updated along the moves, it is only valid where the table is used.
+uint64_t Engine::perft_count(Position* position, int depth, bool color_sign, moves& possible_moves, uint64_t key)
+{
+    // Probe the shared table before generating moves.
+    if(depth >= PERFT_MIN_HASH_DEPTH)
+    {
+        uint64_t entry_node_count;
+        if(perft_table.get_entry_nodes(depth, key, entry_node_count))
+            return entry_node_count;
+    }
+
+    int last_possible_count = possible_moves.move_count;
+    position->determine_moves(color_sign, possible_moves);
+
+    // Base case.
+    if(depth == 1)
+    {
+        uint64_t nodes = possible_moves.move_count - last_possible_count;
+        possible_moves.move_count = last_possible_count;
+        return nodes;
+    }
+
+    uint64_t nodes = 0;
+    int move_count = possible_moves.move_count;
+    bool child_uses_hash = depth - 1 >= PERFT_MIN_HASH_DEPTH;
+    for(int i = last_possible_count; i < move_count; i++)
+    {
+        position->do_move(&possible_moves.moves[i]);
+
+        // Start loading the bucket of the child while its moves are generated.
+        uint64_t child_key = key;
+        if(child_uses_hash)
+        {
+            hasher.update_zobrist_hash(&possible_moves.moves[i], position, child_key);
+            perft_table.prefetch(child_key);
+        }
+
+        nodes += perft_count(position, depth - 1, !color_sign, possible_moves, child_key);
+        position->undo_move(&possible_moves.moves[i]);
+    }
+    possible_moves.move_count = last_possible_count;
+
+    if(depth >= PERFT_MIN_HASH_DEPTH)
+        perft_table.insert_nodes(depth, key, nodes);
+
+    return nodes;
+}
+
+// ==============================================================================================
+
+// Centipawns, or the number of moves to a mate. Negative if the player at turn gets mated.
+static std::string score_to_string(int score)
+{
+    if(std::abs(score) < MATE_BOUND)
+        return std::to_string(score) + " cp";
+
+    int mate_moves = (MATE_SCORE - std::abs(score) + 1) / 2;
+    return "mate " + std::to_string(score > 0 ? mate_moves : -mate_moves);
+}
+
+// ==============================================================================================
+
+// Search the position within the limits and return the best move.
+// Lazy SMP: every thread runs its own iterative deepening on a private position and move stack.
+// The threads only share the transposition table, helpers profit from and add to the entries of the others.
+Move Engine::think(Position* position, const search_limits& limits)
+{
+    // Clear the stop before any setup, a stop() that arrives while the threads are set up must end this search.
+    stop_search.store(false, std::memory_order_relaxed);
+    stop_request_ns.store(-1, std::memory_order_relaxed);
+
+    search_start = std::chrono::steady_clock::now();
+    current_limits = limits;
+    allocate_time(limits, position->white_to_turn);
+    transposition_table.new_search();
+    int max_depth = limits.depth > 0 ? std::min(limits.depth, MAX_SEARCH_DEPTH) : MAX_SEARCH_DEPTH;
+
+    // Set up the threads.
+    std::vector<search_thread> threads(search_thread_count);
+    for(int i = 0; i < search_thread_count; i++)
+    {
+        threads[i].thread_index = i;
+        threads[i].position = Position(*position);
+        threads[i].move_stack = std::make_unique<moves>();
+        threads[i].move_stack->move_count = 0;
+        threads[i].history = std::make_unique<search_history>();
+        threads[i].pawn_table = std::make_unique<PawnTable>();
+        threads[i].material_table = std::make_unique<MaterialTable>();
+        for(int ply = 0; ply < MAX_SEARCH_PLY; ply++)
+            threads[i].killers[ply][0] = threads[i].killers[ply][1] = Move(64, 64);
+    }
+
+    // Helpers run until the main thread is done.
+    bool color_sign = !position->white_to_turn;
+    std::vector<std::thread> helpers;
+    for(int i = 1; i < search_thread_count; i++)
+        helpers.emplace_back(&Engine::iterative_deepening, this, std::ref(threads[i]), color_sign, max_depth);
+
+    iterative_deepening(threads[0], color_sign, max_depth);
+
+    // Stop latency: from the stop request, or the hard time limit, until the main thread returned.
+    auto main_done = std::chrono::steady_clock::now();
+    int64_t stop_request = stop_request_ns.load(std::memory_order_relaxed);
+    last_stop_latency_ms = -1.0;
+    if(stop_request >= 0)
+        last_stop_latency_ms = (std::chrono::duration_cast<std::chrono::nanoseconds>(main_done.time_since_epoch()).count() - stop_request) / 1000000.0;
+
+    stop_search.store(true, std::memory_order_relaxed);
+    for(std::thread& helper : helpers)
+        helper.join();
+
+    // Analysis.
+    uint64_t count = 0;
+    uint64_t quiescence_count = 0;
+    uint64_t beta_cutoffs = 0;
+    uint64_t first_move_cutoffs = 0;
+    uint64_t pawn_probes = 0;
+    uint64_t pawn_hits = 0;
+    for(search_thread& thread : threads)
+    {
+        count += thread.nodes;
+        quiescence_count += thread.quiescence_nodes;
+        beta_cutoffs += thread.beta_cutoffs;
+        first_move_cutoffs += thread.first_move_cutoffs;
+        pawn_probes += thread.pawn_probes;
+        pawn_hits += thread.pawn_hits;
+    }
+    double elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - search_start).count();
+    
+    // Output results.
+    std::cout << "Threads: " << search_thread_count << "\n";
+    std::cout << "Depth: " << threads[0].completed_depth << "\n";
+    std::cout << "Positions evaluated: " << count << " (quiescence: " << quiescence_count << ")\n";
+    std::cout << "Score found was: " << score_to_string(threads[0].best_score) << "\n";
+    std::cout << "Average positions per second: " << count / elapsed_seconds << '\n';
+    std::cout << "Time taken: " << elapsed_seconds << "\n";
+    if(beta_cutoffs > 0)
+        std::cout << "First move cutoff rate: " << 100.0 * first_move_cutoffs / beta_cutoffs << "%\n";
+    if(pawn_probes > 0)
+        std::cout << "Pawn hash hit rate: " << 100.0 * pawn_hits / pawn_probes << "%\n";
+    if(last_stop_latency_ms >= 0.0)
+        std::cout << "Stop latency: " << last_stop_latency_ms << " ms\n";
+
+    // 64 is the signal that the position has no legal moves.
+    return threads[0].best_move;
+}
+
+// ==============================================================================================
+
+// Function to return the best found move.
+void Engine::best_move(Position* position, int depth, Move& best_move)
+{
+    search_limits limits;
+    limits.depth = depth;
+    best_move = think(position, limits);
+}
+
+// ==============================================================================================
+
+// Start unlimited searches, stop them after a random time and report how long they took to return.
+void Engine::do_stop_latency_test(Position* position, int runs)
+{
+    std::mt19937 generator(runs);
+    std::uniform_int_distribution<int> stop_after_ms(STOP_TEST_MIN_MS, STOP_TEST_MAX_MS);
+
+    double total_latency = 0.0;
+    double max_latency = 0.0;
+    for(int run = 0; run < runs; run++)
+    {
+        search_limits limits;
+        Move found;
+        std::thread searcher([this, position, &limits, &found]() { found = think(position, limits); });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(stop_after_ms(generator)));
+        stop();
+        searcher.join();
+
+        total_latency += last_stop_latency_ms;
+        max_latency = std::max(max_latency, last_stop_latency_ms);
+    }
+
+    std::cout << "================================================================================ \n";
+    std::cout << "Stop latency test, runs: " << runs << " Threads: " << search_thread_count << '\n';
+    std::cout << "Average stop latency: " << total_latency / std::max(runs, 1) << " ms\n";
+    std::cout << "Max stop latency: " << max_latency << " ms\n";
+    std::cout << "================================================================================ \n";
+}
+
+// ==============================================================================================
+
+// Score, depth and move the stress test stores for a key. Every key always gets the same entry,
+// so a probe can check that what it read was written for its key.
+static void tt_stress_entry(uint64_t key, int& score, int& depth, uint16_t& move)
+{
+    uint64_t mix = key * 0x9E3779B97F4A7C15ULL;
+    score = int(mix >> 20 & 0x1FFF) - 0x1000;
+    depth = 1 + int(mix >> 40 & 0x3F);
+    move = uint16_t(mix >> 48) | 1;
+}
+
+// ==============================================================================================
+
+// Hammer a few buckets of the transposition table from many threads, and check that every entry
+// a probe returns is one that was stored for its key. Returns false if any corrupt entry was read.
+bool Engine::run_tt_stress_test(int thread_count, int seconds)
+{
+    thread_count = std::max(thread_count, 1);
+
+    // Random keys folded onto the first buckets of the table.
+    std::mt19937_64 generator(TT_STRESS_KEYS);
+    std::vector<uint64_t> keys(TT_STRESS_KEYS);
+    for(uint64_t& key : keys)
+        key = (generator() & ~transposition_table.bucket_mask) | generator() % TT_STRESS_BUCKETS;
+
+    transposition_table.clear_table(thread_count);
+
+    std::atomic<bool> done = false;
+    std::atomic<uint64_t> probes = 0;
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> corrupt = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> workers;
+    for(int worker = 0; worker < thread_count; worker++)
+    {
+        workers.emplace_back([this, worker, &keys, &done, &probes, &hits, &corrupt]()
+        {
+            std::mt19937 worker_generator(worker);
+            uint64_t worker_probes = 0;
+            uint64_t worker_hits = 0;
+            uint64_t worker_corrupt = 0;
+
+            while(!done.load(std::memory_order_relaxed))
+            {
+                uint64_t key = keys[worker_generator() % TT_STRESS_KEYS];
+                int score, depth;
+                uint16_t move;
+                tt_stress_entry(key, score, depth, move);
+
+                if(worker_generator() & 1)
+                {
+                    transposition_table.insert_hash(depth, score, hashfEXACT, 0, key, move);
+                    continue;
+                }
+
+                uint16_t hash_move = 0;
+                int entry_score = transposition_table.read_hash_entry(MIN_EVAL, MAX_EVAL, 0, 0, key, hash_move);
+                worker_probes++;
+                if(entry_score == no_hash_entry)
+                    continue;
+
+                worker_hits++;
+                if(entry_score != score || hash_move != move)
+                    worker_corrupt++;
+            }
+
+            probes += worker_probes;
+            hits += worker_hits;
+            corrupt += worker_corrupt;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    done = true;
+    for(std::thread& worker : workers)
+        worker.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    double time_cost = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000000.0;
+
+    transposition_table.clear_table(thread_count);
+
+    std::cout << "================================================================================ \n";
+    std::cout << "Transposition table stress test, threads: " << thread_count << " Buckets: " << TT_STRESS_BUCKETS << " Keys: " << TT_STRESS_KEYS << '\n';
+    std::cout << "Probes: " << probes << " Hits: " << hits << '\n';
+    std::cout << "Corrupt entries: " << corrupt << '\n';
+    std::cout << "Time cost: " << time_cost << " seconds\n";
+    std::cout << (probes / time_cost) / 1000000.0 << " Million probes per second\n";
+    std::cout << "================================================================================ \n";
+
+    return corrupt == 0;
+}
+
+// ==============================================================================================
+
+// Set the number of Lazy SMP search threads.
+void Engine::set_search_threads(int thread_count)
+{
+    search_thread_count = std::max(thread_count, 1);
+}
+
+// ==============================================================================================
+
+// Set the size of the transposition table in MB. The pages of the new table are touched by one temporary
+// thread per search thread, they are not pinned to cores.
+void Engine::set_hash_mb(int size_mb)
+{
+    transposition_table.resize(size_mb, search_thread_count);
+}
+
+// ==============================================================================================
+
+// Save the transposition table to a file.
+bool Engine::save_hash(const std::string& file_name)
+{
+    if(!transposition_table.save_file(file_name, hasher.key_set_check()))
+    {
+        std::cout << "Could not save hash file: " << file_name << '\n';
+        return false;
+    }
+
+    std::cout << "Hash file saved: " << file_name << " (" << transposition_table.size_bytes() / (1024 * 1024) << " MB)\n";
+    return true;
+}
+
+// ==============================================================================================
+
+// Load the transposition table of an earlier run. The pages are read in when the search touches them.
+bool Engine::load_hash(const std::string& file_name)
+{
+    if(!transposition_table.load_file(file_name, hasher.key_set_check()))
+    {
+        std::cout << "Could not load hash file: " << file_name << '\n';
+        return false;
+    }
+
+    std::cout << "Hash file loaded: " << file_name << " (" << transposition_table.size_bytes() / (1024 * 1024) << " MB)\n";
+    return true;
+}
+
+// ==============================================================================================
+
+// Share the transposition table with other engine processes through POSIX shared memory.
+bool Engine::open_shared_hash(const std::string& name, int size_mb)
+{
+    if(!transposition_table.attach_shared(name, size_mb, hasher.key_set_check()))
+    {
+        std::cout << "Could not attach shared hash: " << name << '\n';
+        return false;
+    }
+
+    std::cout << "Shared hash: " << name << (transposition_table.created_shared_segment() ? " (created)" : " (attached)") << '\n';
+    return true;
+}
+
+// ==============================================================================================
+
+// Forget the transposition table of the last game. Cleared by the search threads.
+void Engine::new_game()
+{
+    if(!transposition_table.is_shared())
+        transposition_table.clear_table(search_thread_count);
+}
+
+// ==============================================================================================
+
+// Also search quiet checking moves in the first ply of the quiescence search.
+void Engine::set_quiescence_checks(bool enabled)
+{
+    qsearch_checks = enabled;
+}
+
+// ==============================================================================================
+
+// Time manager. A move time is used as it is. With a clock we spend our time divided over the moves we expect
+// to still play, plus most of the increment. An iteration that starts past half of that rarely finishes, so it is not started.
+void Engine::allocate_time(const search_limits& limits, bool white_to_move)
+{
+    int time_left = white_to_move ? limits.wtime : limits.btime;
+    int increment = white_to_move ? limits.winc : limits.binc;
+
+    if(limits.movetime > 0)
+    {
+        hard_time_ms = limits.movetime;
+        soft_time_ms = limits.movetime;
+    }
+    else if(time_left > 0)
+    {
+        int64_t budget = time_left / TIME_MOVES_TO_GO + increment * 3 / 4;
+        hard_time_ms = std::max<int64_t>(1, std::min<int64_t>(budget, time_left - TIME_OVERHEAD_MS));
+        soft_time_ms = hard_time_ms / 2;
+    }
+    else
+    {
+        hard_time_ms = 0;
+        soft_time_ms = 0;
+    }
+}
+
+// ==============================================================================================
+
+// Stop the running search from another thread. The search returns its best move within SEARCH_CHECK_NODES nodes.
+void Engine::stop()
+{
+    int64_t request = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    // Keep the first request, the latency is measured from there.
+    int64_t no_request = -1;
+    stop_request_ns.compare_exchange_strong(no_request, request, std::memory_order_relaxed);
+    stop_search.store(true, std::memory_order_relaxed);
+}
+
+// ==============================================================================================
+
+// Poll the stop flag. Called every SEARCH_CHECK_NODES nodes, the main thread checks the node and time limits first.
+void Engine::check_stop(search_thread& thread)
+{
+    if(thread.thread_index == 0 && !stop_search.load(std::memory_order_relaxed))
+    {
+        if(current_limits.nodes > 0 && thread.nodes >= current_limits.nodes)
+        {
+            stop();
+        }
+        else if(hard_time_ms > 0)
+        {
+            auto elapsed = std::chrono::steady_clock::now() - search_start;
+            if(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() >= hard_time_ms)
+            {
+                // The deadline is when we should have stopped, measure the latency from there.
+                int64_t deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(search_start.time_since_epoch()).count() + hard_time_ms * 1000000;
+                int64_t no_request = -1;
+                stop_request_ns.compare_exchange_strong(no_request, deadline, std::memory_order_relaxed);
+                stop_search.store(true, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    thread.stopped = stop_search.load(std::memory_order_relaxed);
+}
+
+// ==============================================================================================
+
+// Iterative deepening of one search thread. Helpers with an odd index search one ply deeper than the main thread,
+// so the threads do not all walk the same tree in the same order. Every iteration starts with the line of the previous one.
+void Engine::iterative_deepening(search_thread& thread, bool color_sign, int max_depth)
+{
+    // The keys of the other plies are updated along the moves.
+    thread.keys[0] = hasher.calculate_zobrist_key(&thread.position, color_sign);
+    thread.pawn_keys[0] = hasher.calculate_pawn_key(&thread.position);
+
+    // A stop can arrive before the first root move of depth 1 is done, the first legal move is the answer then.
+    // Move(64, 64) stays reserved for a position without legal moves.
+    moves& root_moves = *thread.move_stack;
+    int first_move = root_moves.move_count;
+    thread.position.determine_moves(color_sign, root_moves);
+    if(root_moves.move_count > first_move)
+        thread.best_move = root_moves.moves[first_move];
+    root_moves.move_count = first_move;
+
+    for(int depth = 1; depth <= max_depth; depth++)
+    {
+        int search_depth = std::min(depth + (thread.thread_index & 1), MAX_SEARCH_DEPTH);
+
+        thread.root_depth = search_depth;
+
+        // Aspiration window around the score of the last iteration. A score outside of it only tells that the
+        // real score lies beyond that side, so the window is widened on that side and the iteration searched again.
+        // Mate scores change by a ply per iteration, they get the full window.
+        int alpha = MIN_EVAL;
+        int beta = MAX_EVAL;
+        int window = ASPIRATION_WINDOW;
+        if(thread.completed_depth >= ASPIRATION_MIN_DEPTH && std::abs(thread.best_score) < MATE_BOUND)
+        {
+            alpha = std::max(thread.best_score - window, MIN_EVAL);
+            beta = std::min(thread.best_score + window, MAX_EVAL);
+        }
+
+        Move best_found = Move(64, 64);
+        int score;
+        while(true)
+        {
+            thread.root_moves_searched = 0;
+            thread.following_pv = thread.previous_pv_length > 0;
+            score = search(thread, search_depth, 0, alpha, beta, best_found, true);
+            if(thread.stopped)
+                break;
+
+            window *= 2;
+            if(score <= alpha && alpha > MIN_EVAL)
+                alpha = std::max(score - window, MIN_EVAL);
+            else if(score >= beta && beta < MAX_EVAL)
+                beta = std::min(score + window, MAX_EVAL);
+            else
+                break;
+        }
+
+        // Stopped. A partly searched iteration still improves on the last one once its first move, the old best, is done.
+        if(thread.stopped)
+        {
+            if(thread.root_moves_searched > 0)
+                thread.best_move = best_found;
+            return;
+        }
+
+        thread.best_move = best_found;
+        thread.best_score = score;
+        thread.completed_depth = search_depth;
+
+        // Keep the line for the next iteration.
+        thread.previous_pv_length = thread.pv_length[0];
+        for(int ply = 0; ply < thread.pv_length[0]; ply++)
+            thread.previous_pv[ply] = thread.pv_table[0][ply];
+
+        if(thread.thread_index != 0)
+            continue;
+
+        print_iteration(thread);
+
+        // Not enough time left for another iteration.
+        auto elapsed = std::chrono::steady_clock::now() - search_start;
+        if(soft_time_ms > 0 && std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() >= soft_time_ms)
+            return;
+    }
+}
+
+// ==============================================================================================
+
+// Print the result of an iteration of the main thread.
+void Engine::print_iteration(search_thread& thread)
+{
+    double elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - search_start).count();
+
+    std::cout << "Depth: " << thread.completed_depth << " Score: " << score_to_string(thread.best_score) << 
+        " Nodes: " << thread.nodes << " Time: " << elapsed_seconds << " PV:";
+    for(int ply = 0; ply < thread.pv_length[0]; ply++)
+        std::cout << ' ' << thread.pv_table[0][ply].to_string();
+    std::cout << '\n';
+}
+
+// ==============================================================================================
+
+// Negamax alpha beta search. Scores are in centipawns from the view of the player at turn, a mate in n plies from the root
+// scores MATE_SCORE - n. The parent calls with a window of -beta, -alpha and negates the returned score.
+int Engine::search(search_thread& thread, int depth, int ply, int alpha, int beta, Move& best_move, bool top_level)
+{
+    // Initialize ==================================================================================================================
+
+    // Check if the search has to stop. If so, the parent calls unwind without using the score.
+    if((thread.nodes & (SEARCH_CHECK_NODES - 1)) == 0)
+        check_stop(thread);
+    if(thread.stopped)
+        return 0;
+
+    Position* position = &thread.position;
+    moves& possible_moves = *thread.move_stack;
+    bool is_black = !position->white_to_turn;
+    thread.pv_length[ply] = ply;
+
+    // The per ply arrays end at MAX_SEARCH_PLY, only extensions make a line this long.
+    if(ply >= MAX_SEARCH_PLY - 1)
+        return evaluate(thread, position, ply);
+
+    // Mate distance pruning. Even mating right here can not beat a shorter mate found before.
+    if(!top_level)
+    {
+        alpha = std::max(alpha, -MATE_SCORE + ply);
+        beta = std::min(beta, MATE_SCORE - ply - 1);
+        if(alpha >= beta)
+            return alpha;
+    }
+
+    // Make hash entries of position. Without a move that raises alpha, the score is an upper bound.
+    int hashf = hashfALPHA;
+    uint64_t key = thread.keys[ply];
+    uint16_t hash_move = 0;
+    int entry_key_value = transposition_table.read_hash_entry(alpha, beta, depth, ply, key, hash_move);
+
+    // Read hash entry.
+    if(entry_key_value != no_hash_entry && !top_level)
+    {
+        // Position wes already evaluated in a different order.
+        thread.following_pv = false;
+        return entry_key_value;
+    }
+
+    // Count unique positions visited.
+    thread.nodes++;
+
+    // End of depth, resolve the captures before evaluating the position.
+    if(depth <= 0)
+    {
+        thread.following_pv = false;
+        thread.nodes--;
+        return quiescence(thread, alpha, beta, ply, 0);
+    }
+
+    bool in_check = position->king_in_check(is_black);
+
+    // Null move pruning. If the player at turn could pass and still fail high, a real move will fail high too.
+    // Not in check, not on the principal variation, not twice in a row, and not with only king and pawns,
+    // where passing can be better than every move (zugzwang).
+    uint64_t major_pieces = position->bit_boards[W_QUEEN + 6 * is_black] | position->bit_boards[W_ROOK + 6 * is_black];
+    uint64_t minor_pieces = position->bit_boards[W_BISHOP + 6 * is_black] | position->bit_boards[W_KNIGHT + 6 * is_black];
+    if(!top_level && !in_check && !thread.following_pv && depth >= NULL_MOVE_MIN_DEPTH && ply >= thread.null_move_min_ply 
+        && thread.played_piece[ply - 1] != EMPTY && (major_pieces | minor_pieces) != 0 && beta < MATE_BOUND)
+    {
+        int static_eval = evaluate(thread, position, ply);
+        if(static_eval >= beta)
+        {
+            int reduction = NULL_MOVE_REDUCTION + depth / NULL_MOVE_DEPTH_DIVISOR + std::min((static_eval - beta) / NULL_MOVE_EVAL_DIVISOR, NULL_MOVE_EVAL_MAX);
+
+            Move null_move = Move(64, 64);
+            position->do_null_move(&null_move);
+            thread.played_piece[ply] = EMPTY;
+            thread.keys[ply + 1] = key;
+            hasher.update_zobrist_hash_null(&null_move, position, thread.keys[ply + 1]);
+            thread.pawn_keys[ply + 1] = thread.pawn_keys[ply];
+            transposition_table.prefetch(thread.keys[ply + 1]);
+            int score = -search(thread, depth - 1 - reduction, ply + 1, -beta, -beta + 1, best_move, false);
+            position->undo_null_move(&null_move);
+            if(thread.stopped)
+                return 0;
+
+            if(score >= beta)
+            {
+                // With only minor pieces, or deep in the tree, a zugzwang would cost too much. Verify the cutoff with a
+                // reduced search of the real moves, which may not use null moves itself in its first plies.
+                if(major_pieces == 0 || depth >= NULL_MOVE_VERIFY_DEPTH)
+                {
+                    int null_move_min_ply = thread.null_move_min_ply;
+                    thread.null_move_min_ply = ply + 3 * (depth - reduction) / 4;
+                    score = search(thread, depth - reduction, ply, beta - 1, beta, best_move, false);
+                    thread.null_move_min_ply = null_move_min_ply;
+                    if(thread.stopped)
+                        return 0;
+                }
+
+                // A pass does not prove a mate, so the cutoff returns beta itself.
+                if(score >= beta)
+                    return beta;
+            }
+        }
+    }
+
+    // Determine possible moves. They are stacked on the moves of the parent calls.
+    int last_possible_count = possible_moves.move_count;
+    position->determine_moves(is_black, possible_moves);
+    int move_count = possible_moves.move_count - last_possible_count;
+
+    // No moves available: mated in check, otherwise stalemate.
+    if(move_count == 0)
+    {
+        thread.following_pv = false;
+        return in_check ? -MATE_SCORE + ply : DRAW_SCORE;
+    }
+
+    // Give every move its search priority.
+    score_moves(thread, possible_moves, last_possible_count, ply, hash_move);
+
+    int eval = MIN_EVAL;
+
+    Move local_best_move = possible_moves.moves[last_possible_count];
+
+    // Actual search. ==================================================================================================================
+    
+    for(int i = last_possible_count; i < last_possible_count + move_count; i++)
+    {
+        // Bring the most promising remaining move to the front.
+        pick_move(possible_moves, i, last_possible_count + move_count);
+
+        // Do move.
+        Move& move = possible_moves.moves[i];
+        int move_number = i - last_possible_count;
+        position->do_move(&move);
+        thread.played_piece[ply] = move.moving_piece;
+        thread.played_to[ply] = move.end_location;
+
+        // Update the key and start loading its bucket, the child probes it after its own setup.
+        thread.keys[ply + 1] = key;
+        hasher.update_zobrist_hash(&move, position, thread.keys[ply + 1]);
+        transposition_table.prefetch(thread.keys[ply + 1]);
+        thread.pawn_keys[ply + 1] = thread.pawn_keys[ply];
+        hasher.update_pawn_key(&move, thread.pawn_keys[ply + 1]);
+
+        // Late move reductions. Late quiet moves and losing captures are searched shallower first,
+        // the more so the deeper the node and the later the move. Moves with a good history are reduced less.
+        int reduction = 0;
+        if(depth >= LMR_MIN_DEPTH && move_number >= LMR_MIN_MOVES && !in_check && move.priority_group >= PRIORITY_QUIET 
+            && !position->king_in_check(!is_black))
+        {
+            reduction = late_move_reductions[std::min(depth, MAX_SEARCH_DEPTH)][std::min(move_number, LMR_MAX_MOVES - 1)];
+            if(is_quiet(move))
+                reduction -= quiet_move_score(thread, move, ply) / HISTORY_MAX;
+            reduction = std::clamp(reduction, 0, depth - 2);
+        }
+
+        // Principal variation search. The first move gets the full window, the others only have to show that they are
+        // not better than alpha, with a null window. A move that beats alpha is searched again at full depth,
+        // and with the full window if its score lies inside it.
+        int score;
+        if(move_number == 0)
+            score = -search(thread, depth - 1, ply + 1, -beta, -alpha, best_move, false);
+        else
+        {
+            score = -search(thread, depth - 1 - reduction, ply + 1, -alpha - 1, -alpha, best_move, false);
+            if(reduction > 0 && !thread.stopped && score > alpha)
+                score = -search(thread, depth - 1, ply + 1, -alpha - 1, -alpha, best_move, false);
+            if(!thread.stopped && score > alpha && score < beta)
+                score = -search(thread, depth - 1, ply + 1, -beta, -alpha, best_move, false);
+        }
+
+        // Undo.
+        position->undo_move(&possible_moves.moves[i]);
+        // Only the first move can continue the previous line.
+        thread.following_pv = false;
+        // Stopped, the score is not valid.
+        if(thread.stopped)
+        {
+            possible_moves.move_count = last_possible_count;
+            return 0;
+        }
+
+        // Evaluate found score and edit alpha and best move accordingly.
+        bool improved = false;
+        if(score > eval)
+        {
+            eval = score;
+            if(eval > alpha)
+            {
+                alpha = eval;
+                improved = true;
+            }
+        }
+
+        if (improved || i == last_possible_count)
+        {
+            local_best_move = Move(possible_moves.moves[i]);
+            if(improved)
+                hashf = hashfEXACT;
+
+            // Principal variation is this move followed by the line of the child.
+            thread.pv_table[ply][ply] = possible_moves.moves[i];
+            for(int next_ply = ply + 1; next_ply < thread.pv_length[ply + 1]; next_ply++)
+                thread.pv_table[ply][next_ply] = thread.pv_table[ply + 1][next_ply];
+            thread.pv_length[ply] = std::max(thread.pv_length[ply + 1], ply + 1);
+
+            // The root move is usable as soon as it is known, in case the search gets stopped.
+            if(top_level)
+                best_move = local_best_move;
+        }
+
+        if(top_level)
+            thread.root_moves_searched++;
+
+        if (eval >= beta)
+        {
+            hashf = hashfBETA;
+            local_best_move = Move(possible_moves.moves[i]);
+
+            // Remember quiet moves that refute a position, they often refute its siblings too.
+            Move& cutoff_move = possible_moves.moves[i];
+            if(is_quiet(cutoff_move))
+            {
+                if(!same_move(cutoff_move, thread.killers[ply][0]))
+                {
+                    thread.killers[ply][1] = thread.killers[ply][0];
+                    thread.killers[ply][0] = cutoff_move;
+                }
+                update_quiet_history(thread, possible_moves, last_possible_count, i, ply, depth);
+            }
+
+            thread.beta_cutoffs++;
+            thread.first_move_cutoffs += i == last_possible_count;
+            break;
+        }
+    }
+    possible_moves.move_count = last_possible_count;
+
+    if(top_level)
+        best_move = local_best_move;
+
+    transposition_table.insert_hash(depth, eval, hashf, ply, key, pack_move(local_best_move));
+    return eval;
+}
+
+// ==============================================================================================
+
+// Quiescence search. Only captures and queen promotions are searched until the position is quiet, so the evaluation
+// is never taken in the middle of an exchange. The side to move can stand pat on the static evaluation.
+int Engine::quiescence(search_thread& thread, int alpha, int beta, int ply, int quiescence_ply)
+{
+    if((thread.nodes & (SEARCH_CHECK_NODES - 1)) == 0)
+        check_stop(thread);
+    if(thread.stopped)
+        return 0;
+
+    thread.nodes++;
+    thread.quiescence_nodes++;
+
+    Position* position = &thread.position;
+    moves& possible_moves = *thread.move_stack;
+    bool is_black = !position->white_to_turn;
+
+    // Quiescence results are stored with depth 0, every stored search result is at least as deep.
+    uint64_t key = thread.keys[ply];
+    uint16_t hash_move = 0;
+    int entry_key_value = transposition_table.read_hash_entry(alpha, beta, 0, ply, key, hash_move);
+    if(entry_key_value != no_hash_entry)
+        return entry_key_value;
+
+    // In check there is no standing pat, every evasion is searched.
+    bool in_check = position->king_in_check(is_black);
+
+    int stand_pat = evaluate(thread, position, ply);
+    int eval = -MATE_SCORE + ply;
+    if(!in_check)
+    {
+        if(stand_pat >= beta)
+            return stand_pat;
+        alpha = std::max(alpha, stand_pat);
+        eval = stand_pat;
+    }
+
+    if(ply >= MAX_SEARCH_PLY - 1)
+        return stand_pat;
+
+    int original_alpha = alpha;
+    int last_possible_count = possible_moves.move_count;
+    bool check_moves = in_check || (qsearch_checks && quiescence_ply == 0);
+    if(check_moves)
+        position->determine_moves(is_black, possible_moves);
+    else
+        position->determine_captures(is_black, possible_moves);
+    int move_count = possible_moves.move_count - last_possible_count;
+
+    // No moves in check means current player is mated. Without check, having no captures is not the end of the game.
+    if(in_check && move_count == 0)
+        return -MATE_SCORE + ply;
+
+    // Captures by MVV-LVA, then queen promotions. Quiet moves are only generated in check or for first ply checks.
+    // The evaluation of a move holds the value of the piece it captures.
+    for(int i = last_possible_count; i < possible_moves.move_count; i++)
+    {
+        Move& move = possible_moves.moves[i];
+        uint8_t victim = move.move_takes_an_passant ? W_PAWN : position->get_piece(move.end_location);
+        int score = move.promotion == 1 ? MVV_LVA_VICTIM[W_QUEEN] * 8 : 0;
+        if(victim != EMPTY)
+            score += MVV_LVA_VICTIM[victim % 6] * 8 - MVV_LVA_ATTACKER[move.moving_piece % 6];
+        move.priority_group = PRIORITY_CAPTURE - score;
+        move.evaluation = victim != EMPTY ? SEE_VALUE[victim % 6] : 0;
+    }
+
+    for(int i = last_possible_count; i < last_possible_count + move_count; i++)
+    {
+        pick_move(possible_moves, i, last_possible_count + move_count);
+        Move& move = possible_moves.moves[i];
+
+        bool capture_or_promotion = move.evaluation > 0.f || move.promotion != 0;
+        if(!in_check)
+        {
+            // Under promotions are never better than the queen.
+            if(move.promotion > 1)
+                continue;
+
+            // Quiet moves only get here for first ply checks.
+            if(!capture_or_promotion && !move.is_check(position))
+                continue;
+
+            if(capture_or_promotion)
+            {
+                // Delta pruning: even winning the piece with a margin can not reach alpha.
+                int gain = int(move.evaluation) + (move.promotion == 1 ? SEE_VALUE[W_QUEEN] - SEE_VALUE[W_PAWN] : 0);
+                if(stand_pat + gain + DELTA_MARGIN < alpha)
+                    continue;
+
+                // Captures that lose material in the exchange on the target square.
+                if(!position->see_ge(move, 0))
+                    continue;
+            }
+        }
+
+        position->do_move(&move);
+        thread.keys[ply + 1] = key;
+        hasher.update_zobrist_hash(&move, position, thread.keys[ply + 1]);
+        transposition_table.prefetch(thread.keys[ply + 1]);
+        thread.pawn_keys[ply + 1] = thread.pawn_keys[ply];
+        hasher.update_pawn_key(&move, thread.pawn_keys[ply + 1]);
+        int score = -quiescence(thread, -beta, -alpha, ply + 1, quiescence_ply + 1);
+        position->undo_move(&move);
+
+        if(thread.stopped)
+        {
+            possible_moves.move_count = last_possible_count;
+            return 0;
+        }
+
+        eval = std::max(eval, score);
+        alpha = std::max(alpha, eval);
+        if(alpha >= beta)
+            break;
+    }
+    possible_moves.move_count = last_possible_count;
+
+    int hashf = eval >= beta ? hashfBETA : eval > original_alpha ? hashfEXACT : hashfALPHA;
+    transposition_table.insert_hash(0, eval, hashf, ply, key, 0);
+    return eval;
+}
+
+// ==============================================================================================
+
+// Whether a piece was moved back plies before ply. A null move moves no piece, so it has no history entries.
+static inline bool previous_move_played(const search_thread& thread, int ply, int back)
+{
+    return ply >= back && thread.played_piece[ply - back] != EMPTY;
+}
+
+// ==============================================================================================
+
+// Move ordering. Lower priorities are searched first: the move of the previous principal variation,
+// the hash move, captures by MVV-LVA and queen promotions, the killer moves, the other quiet moves,
+// and last the captures that lose material by static exchange evaluation.
+void Engine::score_moves(search_thread& thread, moves& possible_moves, int first_move, int ply, uint16_t hash_move)
+{
+    Position* position = &thread.position;
+    search_history& history = *thread.history;
+
+    bool pv_move_found = false;
+    for(int i = first_move; i < possible_moves.move_count; i++)
+    {
+        Move& move = possible_moves.moves[i];
+
+        // The previous iteration is only followed while all moves before were on its line.
+        if(thread.following_pv && ply < thread.previous_pv_length && same_move(move, thread.previous_pv[ply]))
+        {
+            move.priority_group = PRIORITY_PV_MOVE;
+            pv_move_found = true;
+            continue;
+        }
+        if(hash_move != 0 && pack_move(move) == hash_move)
+        {
+            move.priority_group = PRIORITY_HASH_MOVE;
+            continue;
+        }
+
+        uint8_t victim = move.move_takes_an_passant ? W_PAWN : position->get_piece(move.end_location);
+        if(victim != EMPTY || move.promotion == 1)
+        {
+            int score = move.promotion == 1 ? MVV_LVA_VICTIM[W_QUEEN] * 8 : 0;
+            if(victim != EMPTY)
+                score += MVV_LVA_VICTIM[victim % 6] * 8 - MVV_LVA_ATTACKER[move.moving_piece % 6];
+            move.priority_group = (position->see_ge(move, 0) ? PRIORITY_CAPTURE : PRIORITY_LOSING_CAPTURE) - score;
+            continue;
+        }
+
+        if(same_move(move, thread.killers[ply][0]))
+            move.priority_group = PRIORITY_KILLER;
+        else if(same_move(move, thread.killers[ply][1]))
+            move.priority_group = PRIORITY_KILLER + 1;
+        else if(previous_move_played(thread, ply, 1) && pack_move(move) == history.counter_moves[thread.played_piece[ply - 1]][thread.played_to[ply - 1]])
+            move.priority_group = PRIORITY_KILLER + 2;
+        else
+            move.priority_group = PRIORITY_QUIET + 3 * HISTORY_MAX - quiet_move_score(thread, move, ply);
+    }
+    thread.following_pv = pv_move_found;
+}
+
+// ==============================================================================================
+
+// History score of a quiet move: butterfly history plus the continuation history of the moves one and two plies back.
+int Engine::quiet_move_score(search_thread& thread, const Move& move, int ply)
+{
+    search_history& history = *thread.history;
+    int score = history.butterfly[move.moving_piece > 5][move.start_location][move.end_location];
+    if(previous_move_played(thread, ply, 1))
+        score += history.continuation[thread.played_piece[ply - 1]][thread.played_to[ply - 1]][move.moving_piece][move.end_location];
+    if(previous_move_played(thread, ply, 2))
+        score += history.continuation[thread.played_piece[ply - 2]][thread.played_to[ply - 2]][move.moving_piece][move.end_location];
+    return score;
+}
+
+// ==============================================================================================
+
+// Gravity update: the closer a score is to HISTORY_MAX, the less a bonus moves it. Scores stay within +-HISTORY_MAX.
+static inline void update_history_score(int16_t& score, int bonus)
+{
+    score += bonus - score * std::abs(bonus) / HISTORY_MAX;
+}
+
+// ==============================================================================================
+
+// A quiet move caused a beta cutoff. Reward it, punish the quiet moves searched before it, and store it as counter move.
+void Engine::update_quiet_history(search_thread& thread, moves& possible_moves, int first_move, int cutoff_index, int ply, int depth)
+{
+    search_history& history = *thread.history;
+    int bonus = std::min(depth * depth * HISTORY_BONUS_SCALE, HISTORY_BONUS_MAX);
+
+    for(int i = first_move; i <= cutoff_index; i++)
+    {
+        Move& move = possible_moves.moves[i];
+        if(!is_quiet(move))
+            continue;
+
+        int move_bonus = i == cutoff_index ? bonus : -bonus;
+        update_history_score(history.butterfly[move.moving_piece > 5][move.start_location][move.end_location], move_bonus);
+        if(previous_move_played(thread, ply, 1))
+            update_history_score(history.continuation[thread.played_piece[ply - 1]][thread.played_to[ply - 1]][move.moving_piece][move.end_location], move_bonus);
+        if(previous_move_played(thread, ply, 2))
+            update_history_score(history.continuation[thread.played_piece[ply - 2]][thread.played_to[ply - 2]][move.moving_piece][move.end_location], move_bonus);
+    }
+
+    if(previous_move_played(thread, ply, 1))
+        history.counter_moves[thread.played_piece[ply - 1]][thread.played_to[ply - 1]] = pack_move(possible_moves.moves[cutoff_index]);
+}
+
+// ==============================================================================================
+
+// Selection step: swap the move with the lowest priority of index..end to index.
+// Most nodes cut off after a few moves, so this beats sorting the whole list.
+void Engine::pick_move(moves& possible_moves, int index, int end)
+{
+    int best = index;
+    for(int i = index + 1; i < end; i++)
+    {
+        if(possible_moves.moves[i].priority_group < possible_moves.moves[best].priority_group)
+            best = i;
+    }
+    if(best != index)
+        std::swap(possible_moves.moves[best], possible_moves.moves[index]);
+}
+
+// ==============================================================================================
+
+// Number of pieces of a type in a material key.
+static inline int material_count(uint64_t material_key, uint8_t piece)
+{
+    return (material_key >> (4 * piece)) & 0xF;
+}
+
+// ==============================================================================================
+
+// A bare king against mating material. The score only guides the strong side: drive the weak king
+// to the edge and bring the own king closer, the search finds the mate from there.
+static int evaluate_kxk(const Position& position, const material_entry& entry)
+{
+    bool strong_black = entry.strong_side_black;
+    int strong_king = __builtin_clzll(position.bit_boards[W_KING + 6 * strong_black]);
+    int weak_king = __builtin_clzll(position.bit_boards[W_KING + 6 * !strong_black]);
+
+    int edge_distance = std::min(std::min(weak_king % 8, 7 - weak_king % 8), std::min(weak_king / 8, 7 - weak_king / 8));
+    int king_distance = std::max(std::abs(strong_king % 8 - weak_king % 8), std::abs(strong_king / 8 - weak_king / 8));
+    int bonus = (3 - edge_distance) * KXK_EDGE_BONUS + (7 - king_distance) * KXK_KING_DISTANCE_BONUS;
+
+    return entry.score + (strong_black ? -bonus : bonus);
+}
+
+// No pawns and at most a minor piece on both sides, neither side can win.
+static int evaluate_insufficient_material(const Position&, const material_entry&)
+{
+    return DRAW_SCORE;
+}
+
+// ==============================================================================================
+
+// Material of the position from the material hash table of the thread. Filled on a miss, which is rare:
+// the material only changes on captures and promotions.
+const material_entry& Engine::evaluate_material(search_thread& thread, Position* position)
+{
+    material_entry* entry = thread.material_table->probe(position->material_key);
+    if(entry->key != position->material_key)
+    {
+        entry->key = position->material_key;
+        fill_material_entry(*entry);
+    }
+    return *entry;
+}
+
+// ==============================================================================================
+
+// Evaluate a material signature: piece values, bishop pair, imbalance and the endgame evaluator.
+// Only the piece counts in the key are used, so the entry holds for every position with this material.
+void Engine::fill_material_entry(material_entry& entry)
+{
+    int side_points[2] = {};
+    int non_pawn_pieces[2] = {};
+    for(uint8_t color_sign = 0; color_sign < 2; color_sign++)
+    {
+        int pawns = material_count(entry.key, W_PAWN + 6 * color_sign);
+        int knights = material_count(entry.key, W_KNIGHT + 6 * color_sign);
+        int bishops = material_count(entry.key, W_BISHOP + 6 * color_sign);
+        int rooks = material_count(entry.key, W_ROOK + 6 * color_sign);
+        int queens = material_count(entry.key, W_QUEEN + 6 * color_sign);
+
+        float points = pawns * PAWN_VALUE + knights * KNIGHT_VALUE + bishops * BISHOP_VALUE + rooks * ROOK_VALUE + queens * QUEEN_VALUE;
+        if(bishops >= 2)
+            points += BISHOP_PAIR_BONUS * bishhop_pair_weight / 100.f;
+        points += (knights * KNIGHT_PAWN_ADJUSTMENT - rooks * ROOK_PAWN_ADJUSTMENT) * (pawns - 5) / 100.f;
+
+        side_points[color_sign] = int(std::lround(points * 100.f));
+        non_pawn_pieces[color_sign] = knights + bishops + rooks + queens;
+    }
+    entry.score = side_points[0] - side_points[1];
+    entry.strong_side_black = entry.score < 0;
+    entry.evaluator = nullptr;
+
+    bool no_pawns = material_count(entry.key, W_PAWN) == 0 && material_count(entry.key, B_PAWN) == 0;
+    bool no_majors = material_count(entry.key, W_ROOK) + material_count(entry.key, W_QUEEN) 
+        + material_count(entry.key, B_ROOK) + material_count(entry.key, B_QUEEN) == 0;
+    int strong = entry.strong_side_black;
+
+    if(no_pawns && no_majors && non_pawn_pieces[0] <= 1 && non_pawn_pieces[1] <= 1)
+    {
+        entry.evaluator = evaluate_insufficient_material;
+    }
+    // A rook or queen, or two minor pieces other than two knights, mate a bare king.
+    else if(non_pawn_pieces[!strong] == 0 && material_count(entry.key, W_PAWN + 6 * !strong) == 0 
+        && (!no_majors || (non_pawn_pieces[strong] >= 2 && non_pawn_pieces[strong] > material_count(entry.key, W_KNIGHT + 6 * strong))))
+    {
+        entry.evaluator = evaluate_kxk;
+    }
+}
+
+// ==============================================================================================
+
+// Piece square evaluation in centipawns from the view of white.
+int Engine::evaluate_position(Position* position)
+{
+    float total_eval = 0.f;
+
+    // Evaluate piece positions.
+    float black_points = evaluate_square_bonus(position, 1) * square_bonus_weight;
+    float white_points = evaluate_square_bonus(position, 0) * square_bonus_weight;
+    
+    // A pawn is worth piece_value_weight, scale that to 100 centipawns.
+    total_eval = white_points - black_points;
+    return int(std::lround(total_eval * 100.f / piece_value_weight));
+}
+
+// ==============================================================================================
+
+// Static evaluation in centipawns from the view of the player at turn. Material is one lookup in the material
+// hash table, which also tells if the endgame has its own evaluation.
+int Engine::evaluate(search_thread& thread, Position* position, int ply)
+{
+    const material_entry& material = evaluate_material(thread, position);
+    int white_eval = material.evaluator != nullptr ? material.evaluator(*position, material)
+        : material.score + evaluate_position(position) + evaluate_pawns(thread, position, thread.pawn_keys[ply]);
+    return position->white_to_turn ? white_eval : -white_eval;
+}
+
+// ==============================================================================================
+
+// Pawn structure score in centipawns from the view of white. Read from the pawn hash table of the thread,
+// the structure is only evaluated when the pawns are not in it.
+int Engine::evaluate_pawns(search_thread& thread, Position* position, uint64_t pawn_key)
+{
+    pawn_entry* entry = thread.pawn_table->probe(pawn_key);
+    thread.pawn_probes++;
+    if(entry->key == pawn_key)
+    {
+        thread.pawn_hits++;
+        return entry->score;
+    }
+
+    entry->key = pawn_key;
+    entry->score = 0;
+    for(uint8_t color_sign = 0; color_sign < 2; color_sign++)
+    {
+        int score = evaluate_pawns_positions(position, color_sign, *entry);
+        entry->score += color_sign ? -score : score;
+    }
+    return entry->score;
+}
+
+// ==============================================================================================
+
+// Doubled, isolated, backward and passed pawns of one side in centipawns. Also fills in the passed pawns and
+// attack spans of the side in the entry.
+int Engine::evaluate_pawns_positions(Position* position, uint8_t color_sign, pawn_entry& entry)
+{
+    uint64_t own_pawns = position->bit_boards[W_PAWN + 6 * color_sign];
+    uint64_t enemy_pawns = position->bit_boards[W_PAWN + 6 * !color_sign];
+    float score = 0.f;
+
+    entry.passed_pawns[color_sign] = 0;
+    entry.attack_spans[color_sign] = 0;
+    for(uint64_t pawns = own_pawns; pawns; pawns &= pawns - 1)
+    {
+        int square = find_bit_position(pawns);
+        int file = square % 8;
+        // Square in front of the pawn, and its rank from the view of its own side.
+        int stop_square = color_sign ? square + 8 : square - 8;
+        int rank = color_sign ? square / 8 : 7 - square / 8;
+        uint64_t file_ahead = PASSED_PAWN_MASKS[color_sign][square] & ~ADJACENT_FILES[file];
+
+        entry.attack_spans[color_sign] |= PAWN_ATTACK_SPANS[color_sign][square];
+
+        // Only the rear pawn of a doubled pair counts, the front one may still be passed.
+        bool doubled = (own_pawns & file_ahead) != 0;
+        if(doubled)
+            score -= DOUBLED_PAWN_PENALTY * doubled_pawn_weight;
+
+        bool isolated = (own_pawns & ADJACENT_FILES[file]) == 0;
+        if(isolated)
+            score -= ISOLATED_PAWN_PENALTY * isolated_pawn_weight;
+
+        // No pawn beside or behind it can defend it when it advances, and an enemy pawn guards the square in front.
+        // The enemy attack span from the square in front covers the adjacent squares level with and behind the pawn.
+        else if((own_pawns & PAWN_ATTACK_SPANS[!color_sign][stop_square]) == 0 
+            && (enemy_pawns & PAWN_ATTACK_SQUARES[color_sign][stop_square]) != 0)
+            score -= BACKWARD_PAWN_PENALTY * backwards_pawn_weight;
+
+        if(!doubled && (enemy_pawns & PASSED_PAWN_MASKS[color_sign][square]) == 0)
+        {
+            entry.passed_pawns[color_sign] |= 1ULL << (63 - square);
+            score += PASSED_PAWN_BONUS[rank] * passed_pawn_weight;
+        }
+    }
+
+    return int(std::lround(score));
 }
 
 float Engine::evaluate_square_bonus(Position* position, uint8_t color_sign)
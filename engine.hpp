@@ -1,37 +1,228 @@
-#include "transposition_table.hpp"
+#include "material_table.hpp"
+#include "thread_pool.hpp"
+#include <thread>
 #include <math.h>
 #include <stack>
 #include <array>
 #include <ctime>
 #include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 
 #ifndef ENGINE_HPP
 #define ENGINE_HPP
 
+// Subtree of the parallel perft. The moves from the root are replayed on the worker's own position.
+typedef struct
+{
+    int root_move_index;
+    int depth;
+    std::vector<Move> path;
+} perft_task;
+
+// Limits of a search, zero means no limit. Times are in milliseconds.
+typedef struct
+{
+    int depth = 0;
+    uint64_t nodes = 0;
+    int movetime = 0;
+    int wtime = 0;
+    int btime = 0;
+    int winc = 0;
+    int binc = 0;
+} search_limits;
+
+// Quiet move statistics of one search thread, learned from beta cutoffs.
+typedef struct
+{
+    // Butterfly history [color][from][to].
+    int16_t butterfly[2][64][64] = {};
+    // Packed reply to the previous move, indexed by [piece][to] of that move.
+    uint16_t counter_moves[12][64] = {};
+    // Continuation history [previous piece][previous to][piece][to], for the moves one and two plies back.
+    int16_t continuation[12][64][12][64] = {};
+} search_history;
+
+// Search state of one Lazy SMP thread. Threads only share the transposition table.
+typedef struct
+{
+    int thread_index = 0;
+    Position position;
+    std::unique_ptr<moves> move_stack;
+    uint64_t nodes = 0;
+    uint64_t quiescence_nodes = 0;
+    Move best_move = Move(64, 64);
+    int best_score = 0;
+    int completed_depth = 0;
+
+    // Depth of the running iteration.
+    int root_depth = 0;
+    // Root moves finished in the running iteration. Its best move is usable once one is done.
+    int root_moves_searched = 0;
+
+    // Principal variation of the running iteration, pv_table[ply] holds the line from ply on.
+    Move pv_table[MAX_SEARCH_PLY][MAX_SEARCH_PLY];
+    int pv_length[MAX_SEARCH_PLY];
+
+    // Principal variation of the last iteration, searched first by the next one.
+    Move previous_pv[MAX_SEARCH_PLY];
+    int previous_pv_length = 0;
+    bool following_pv = false;
+
+    // Zobrist key of the position at every ply.
+    uint64_t keys[MAX_SEARCH_PLY + 1];
+
+    // Zobrist key of the pawns at every ply, the index of the pawn hash table.
+    uint64_t pawn_keys[MAX_SEARCH_PLY + 1];
+
+    // Null moves are only tried from this ply on. Raised while a null move cutoff gets verified.
+    int null_move_min_ply = 0;
+
+    // Set once the thread saw the stop flag, the running calls unwind without storing anything.
+    bool stopped = false;
+
+    // Two quiet moves per ply that caused a beta cutoff.
+    Move killers[MAX_SEARCH_PLY][2];
+
+    // Piece and end square of the move played at every ply, the keys of the counter move and continuation history.
+    // The piece is EMPTY for a null move.
+    uint8_t played_piece[MAX_SEARCH_PLY];
+    uint8_t played_to[MAX_SEARCH_PLY];
+
+    std::unique_ptr<search_history> history;
+
+    // Pawn structures evaluated by this thread, and how often a position found its pawns there.
+    std::unique_ptr<PawnTable> pawn_table;
+    uint64_t pawn_probes = 0;
+    uint64_t pawn_hits = 0;
+
+    // Material signatures evaluated by this thread.
+    std::unique_ptr<MaterialTable> material_table;
+
+    // Beta cutoffs, and how many of them came from the first move searched. Measures the move ordering.
+    uint64_t beta_cutoffs = 0;
+    uint64_t first_move_cutoffs = 0;
+} search_thread;
+
 class Engine 
 {
 public:
 
-    // Call recursive functions to determine best move.
-    void best_move(Position* position, bool color_sign, int depth,  Move& best_move);
+    // Search the position within the limits and return the best move. Runs iterative deepening on every search thread.
+    // When stopped early, the best move of the deepest iteration that finished at least one root move is returned.
+    Move think(Position* position, const search_limits& limits);
+
+    // Call recursive functions to determine best move. Fixed depth search of the player at turn.
+    void best_move(Position* position, int depth,  Move& best_move);
+
+    // Set the number of Lazy SMP search threads.
+    void set_search_threads(int thread_count);
+
+    // Set the size of the transposition table in MB. The pages of the new table are touched by one temporary
+    // thread per search thread.
+    void set_hash_mb(int size_mb);
+
+    // Save the transposition table to a file, and load it back in a later run. A loaded table takes the size
+    // of the file. Loading fails if the file was written with another format or zobrist key set.
+    bool save_hash(const std::string& file_name);
+    bool load_hash(const std::string& file_name);
+
+    // Share the transposition table with the other engine processes on the host that use the same name,
+    // through POSIX shared memory. Returns false if the segment can not be created or does not match.
+    bool open_shared_hash(const std::string& name, int size_mb);
+
+    // Forget the transposition table of the last game. Searches within a game keep it, older entries are replaced first.
+    // A shared table is kept, the other processes still use it.
+    void new_game();
+
+    // Also search quiet checking moves in the first ply of the quiescence search.
+    void set_quiescence_checks(bool enabled);
 
     void do_perft_test(int depth, Position* position, bool white_to_move);
 
-    uint64_t perft_test(Position* position, int depth, bool color_sign, moves& possible_moves);
+    // Set the size of the perft table in MB.
+    void set_perft_hash_mb(int size_mb);
+
+    // Keep the perft table in a memory mapped file, so later runs reuse the stored counts. Returns false if it can not be mapped.
+    bool open_perft_cache(const std::string& file_name, int size_mb);
+
+    uint64_t perft_test(Position* position, int depth, bool color_sign, moves& possible_moves, uint64_t key);
+
+    // Perft test on multiple threads. The tree is split into tasks at split_depth plies from the root.
+    void do_parallel_perft_test(int depth, Position* position, bool white_to_move, int thread_count, int split_depth);
+
+    // Run the parallel perft for an increasing number of threads and report the scaling.
+    void do_perft_scaling_test(int depth, Position* position, bool white_to_move, int max_threads, int split_depth);
 
-    bool time_up = false;
+    // Run every position of an EPD perft suite up to max_depth. Returns false if any node count is wrong or can not be read,
+    // or if no position has a count up to max_depth. Positions without such a count are reported as unchecked.
+    bool run_perft_suite(const std::string& file_name, int max_depth, int thread_count);
+
+    // Check that every FEN of a file and the positions a few plies after it survive a FEN round trip,
+    // then time bulk loading all of them repeat times. Lines with the EPD operation 'invalid' must be rejected.
+    // Returns false if any round trip fails or an invalid line is accepted.
+    bool run_fen_test(const std::string& file_name, int repeat);
+
+    // Perft split into FEN + depth jobs for worker processes. Without a worker command the workers are forked
+    // locally, otherwise every worker runs the command, e.g. "ssh host ./main perftworker".
+    // Finished jobs are appended to the journal file if one is given, so an interrupted run can be resumed.
+    bool do_distributed_perft_test(int depth, Position* position, int worker_count, int split_depth, const std::string& worker_command, const std::string& journal_file);
+
+    // Answer distributed perft jobs from input_fd on output_fd until the input closes.
+    void run_perft_worker(int input_fd, int output_fd);
+
+    // Stop the running search from another thread. A stop during the setup of think also ends that search.
+    void stop();
+
+    // Time from the last stop request, or the hard time limit, until the search returned. Negative if it was not stopped.
+    double last_stop_latency_ms = -1.0;
+
+    // Measure the stop latency of searches that get stopped after a random time.
+    void do_stop_latency_test(Position* position, int runs);
+
+    // Hammer a few buckets of the transposition table from many threads, and check that every entry
+    // a probe returns is one that was stored for its key. Returns false if any corrupt entry was read.
+    bool run_tt_stress_test(int thread_count, int seconds);
 
     Engine();
 
 private:
     // Working but can be improved later:
 
-    float search(int current_depth, int alpha, int beta, int& position_count, Position* position, Move& best_move, bool top_level, bool maximizing, int depth_limit, moves possible_moves);
+    uint64_t parallel_perft(Position* position, int depth, bool white_to_move, int thread_count, int split_depth, moves& root_moves, std::vector<uint64_t>& root_nodes);
+
+    void make_perft_tasks(Position* position, int depth, int plies_left, bool color_sign, moves& possible_moves, std::vector<Move>& path, int root_move_index, std::vector<perft_task>& tasks);
+
+    uint64_t perft_count(Position* position, int depth, bool color_sign, moves& possible_moves, uint64_t key);
+
+    void collect_fen_positions(Position* position, int plies_left, moves& possible_moves, std::vector<std::string>& fens);
+
+    bool check_fen_round_trip(const Position& position, const std::string& fen);
+
+    void iterative_deepening(search_thread& thread, bool color_sign, int max_depth);
+
+    void allocate_time(const search_limits& limits, bool white_to_move);
+
+    void check_stop(search_thread& thread);
+
+    void print_iteration(search_thread& thread);
 
-    float evaluate_piece_sum(Position* position, uint8_t color_sign);
+    int search(search_thread& thread, int depth, int ply, int alpha, int beta, Move& best_move, bool top_level);
 
-    float evaluate_position(Position* position);
+    int quiescence(search_thread& thread, int alpha, int beta, int ply, int quiescence_ply);
+
+    const material_entry& evaluate_material(search_thread& thread, Position* position);
+
+    void fill_material_entry(material_entry& entry);
+
+    int evaluate_position(Position* position);
+
+    int evaluate(search_thread& thread, Position* position, int ply);
+
+    int evaluate_pawns(search_thread& thread, Position* position, uint64_t pawn_key);
+
+    int evaluate_pawns_positions(Position* position, uint8_t color_sign, pawn_entry& entry);
 
     // TODO:
 
@@ -61,9 +252,13 @@ private:
 
     float evaluate_queen_position(Position* position, uint8_t color_sign);
 
-    float evaluate_pawns_positions(Position* position, uint8_t color_sign);
+    void score_moves(search_thread& thread, moves& possible_moves, int first_move, int ply, uint16_t hash_move);
+
+    void pick_move(moves& possible_moves, int index, int end);
 
-    void sort_move_priority(std::vector<Move>& moves, Position* position);
+    int quiet_move_score(search_thread& thread, const Move& move, int ply);
+
+    void update_quiet_history(search_thread& thread, moves& possible_moves, int first_move, int cutoff_index, int ply, int depth);
 
     // Params.
 
@@ -80,8 +275,31 @@ private:
     const float piece_value_weight = 2.f;
     const float square_bonus_weight = 0.5f;
 
+    // Late move reductions in plies, indexed by [depth][move number].
+    int late_move_reductions[MAX_SEARCH_DEPTH + 1][LMR_MAX_MOVES] = {};
+
+    // Shared by all search threads.
     TranspositionTable transposition_table;
 
+    int search_thread_count = 1;
+
+    bool qsearch_checks = false;
+
+    // Stops every search thread. Set by stop(), by the main thread when a limit is reached, and when the main thread is done.
+    std::atomic<bool> stop_search = false;
+    // Steady clock time in nanoseconds at which the stop was requested, -1 if it was not.
+    std::atomic<int64_t> stop_request_ns = -1;
+
+    // Limits of the running search, checked by the main search thread.
+    search_limits current_limits;
+    std::chrono::steady_clock::time_point search_start;
+    // Past the soft time no new iteration is started, past the hard time the search stops. Zero means no limit.
+    int64_t soft_time_ms = 0;
+    int64_t hard_time_ms = 0;
+
+    // Shared by all perft workers.
+    PerftTable perft_table;
+
     ZobristHash hasher;
 
     int currently_evaluating_perft_depth;
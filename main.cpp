@@ -6,17 +6,172 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <stdexcept>
+#include <memory>
 
-void calculate_best_move(Engine* engine, Position* position, int color_sign, int depth, Move& result) 
+// Let the engine search on its own thread, so the window keeps responding.
+void calculate_best_move(Engine* engine, Position* position, int movetime, Move& result) 
 {
-    // move_found = false;
-    // engine->best_move(position, color_sign, depth, result);
-    // engine_is_searching = false;
-    // move_found = true;
+    search_limits limits;
+    limits.movetime = movetime;
+    result = engine->think(position, limits);
+    engine_is_searching = false;
+    move_found = true;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    // Command line modes, these run without the GUI.
+    if(argc > 1)
+    {
+        std::string mode = argv[1];
+        int thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+        // Bad numbers and FENs throw, report them with the usage instead of aborting.
+        try
+        {
+            // perftsuite <epd file> [depth] [threads]: check the node counts of every position in the file.
+            if(mode == "perftsuite" && argc > 2)
+            {
+                int depth = argc > 3 ? std::stoi(argv[3]) : PERFT_SUITE_DEPTH;
+                thread_count = argc > 4 ? std::stoi(argv[4]) : thread_count;
+                Engine engine;
+                return engine.run_perft_suite(argv[2], depth, thread_count) ? 0 : 1;
+            }
+
+            // perft <depth> [fen|startpos] [threads] [cache file] [cache MB]: divide from a position, the start position by default.
+            // With a cache file the subtree counts are kept on disk and reused by the next run.
+            if(mode == "perft" && argc > 2)
+            {
+                int depth = std::stoi(argv[2]);
+                bool custom_position = argc > 3 && std::string(argv[3]) != "startpos";
+                Position position = custom_position ? Position::from_fen(argv[3]) : Position();
+                thread_count = argc > 4 ? std::stoi(argv[4]) : thread_count;
+                Engine engine;
+                if(argc > 5 && !engine.open_perft_cache(argv[5], argc > 6 ? std::stoi(argv[6]) : PERFT_CACHE_MB))
+                    return 1;
+                engine.do_parallel_perft_test(depth, &position, position.white_to_turn, thread_count, PERFT_SPLIT_DEPTH);
+                return 0;
+            }
+
+            // distperft <depth> <workers> [fen|startpos] [journal] [worker command]: perft over worker processes.
+            if(mode == "distperft" && argc > 3)
+            {
+                int depth = std::stoi(argv[2]);
+                int worker_count = std::stoi(argv[3]);
+                bool custom_position = argc > 4 && std::string(argv[4]) != "startpos";
+                Position position = custom_position ? Position::from_fen(argv[4]) : Position();
+                std::string journal_file = argc > 5 ? argv[5] : "";
+                std::string worker_command = argc > 6 ? argv[6] : "";
+                Engine engine;
+                return engine.do_distributed_perft_test(depth, &position, worker_count, DISTRIBUTED_PERFT_SPLIT_DEPTH, worker_command, journal_file) ? 0 : 1;
+            }
+
+            // perftworker: answer distributed perft jobs on stdin and stdout.
+            if(mode == "perftworker")
+            {
+                Engine engine;
+                engine.run_perft_worker(0, 1);
+                return 0;
+            }
+
+            // search <fen|startpos> [threads] [depth N] [nodes N] [movetime N] [wtime N] [btime N] [winc N] [binc N] [hash MB] [hashfile F] [sharedhash NAME]:
+            // search a position within the given limits, times in milliseconds. A hash file is loaded before the search
+            // if it exists, and the table is saved to it afterwards, so the next analysis of the position starts warm.
+            // With a shared hash name the table lives in shared memory and is used by every process that gives the same name.
+            if(mode == "search" && argc > 2)
+            {
+                Position position = std::string(argv[2]) != "startpos" ? Position::from_fen(argv[2]) : Position();
+                thread_count = argc > 3 ? std::stoi(argv[3]) : thread_count;
+
+                search_limits limits;
+                int hash_mb = HASH_TABLE_MB;
+                std::string hash_file;
+                std::string shared_hash;
+                for(int i = 4; i + 1 < argc; i += 2)
+                {
+                    std::string limit = argv[i];
+                    if(limit == "hashfile")
+                    {
+                        hash_file = argv[i + 1];
+                        continue;
+                    }
+                    if(limit == "sharedhash")
+                    {
+                        shared_hash = argv[i + 1];
+                        continue;
+                    }
+                    int value = std::stoi(argv[i + 1]);
+                    if(limit == "depth") limits.depth = value;
+                    else if(limit == "nodes") limits.nodes = value;
+                    else if(limit == "movetime") limits.movetime = value;
+                    else if(limit == "wtime") limits.wtime = value;
+                    else if(limit == "btime") limits.btime = value;
+                    else if(limit == "winc") limits.winc = value;
+                    else if(limit == "binc") limits.binc = value;
+                    else if(limit == "hash") hash_mb = value;
+                }
+
+                Engine engine;
+                engine.set_search_threads(thread_count);
+                if(shared_hash.empty())
+                    engine.set_hash_mb(hash_mb);
+                else if(!engine.open_shared_hash(shared_hash, hash_mb))
+                    return 1;
+                if(!hash_file.empty() && std::ifstream(hash_file).good())
+                    engine.load_hash(hash_file);
+                Move best_move = engine.think(&position, limits);
+                std::cout << "Move found: " << best_move.to_string() << '\n';
+                if(!hash_file.empty() && !engine.save_hash(hash_file))
+                    return 1;
+                return 0;
+            }
+
+            // stoplatency <fen|startpos> [threads] [runs]: stop searches after a random time and report the latency.
+            if(mode == "stoplatency" && argc > 2)
+            {
+                Position position = std::string(argv[2]) != "startpos" ? Position::from_fen(argv[2]) : Position();
+                thread_count = argc > 3 ? std::stoi(argv[3]) : thread_count;
+                int runs = argc > 4 ? std::stoi(argv[4]) : 10;
+                Engine engine;
+                engine.set_search_threads(thread_count);
+                engine.do_stop_latency_test(&position, runs);
+                return 0;
+            }
+
+            // ttstress [threads] [seconds]: hammer a few transposition table buckets from many threads and check every probe.
+            if(mode == "ttstress")
+            {
+                thread_count = argc > 2 ? std::stoi(argv[2]) : thread_count;
+                int seconds = argc > 3 ? std::stoi(argv[3]) : TT_STRESS_SECONDS;
+                Engine engine;
+                return engine.run_tt_stress_test(thread_count, seconds) ? 0 : 1;
+            }
+
+            // fentest <fen or epd file> [repeat]: FEN round trip check and bulk load benchmark.
+            if(mode == "fentest" && argc > 2)
+            {
+                int repeat = argc > 3 ? std::stoi(argv[3]) : FEN_TEST_REPEAT;
+                Engine engine;
+                return engine.run_fen_test(argv[2], repeat) ? 0 : 1;
+            }
+        }
+        catch(const std::invalid_argument& error)
+        {
+            std::cout << "Invalid argument: " << error.what() << '\n';
+        }
+        catch(const std::out_of_range& error)
+        {
+            std::cout << "Argument out of range: " << error.what() << '\n';
+        }
+
+        std::cout << "Usage: main [perftsuite <epd file> [depth] [threads]] [perft <depth> [fen|startpos] [threads] [cache file] [cache MB]] [fentest <file> [repeat]]\n" <<
+            "       main [search <fen|startpos> [threads] [depth|nodes|movetime|wtime|btime|winc|binc|hash N] [hashfile F] [sharedhash NAME]...] [stoplatency <fen|startpos> [threads] [runs]]\n" <<
+            "       main [ttstress [threads] [seconds]]\n" <<
+            "       main [distperft <depth> <workers> [fen|startpos] [journal] [worker command]] [perftworker]\n";
+        return 1;
+    }
+
     Board* board = new Board();
     
     sf::Texture texture;
@@ -25,8 +180,6 @@ int main()
         return 1;
     } 
 
-    clock_t start;
-
     float last_time_check = 0.f;
 
     int checkpoint_count = 0;
@@ -43,14 +196,25 @@ int main()
 
     int perft_depth_limit = PERFT_DEPTH;
 
+    int perft_thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    // Perft table size in MB. Deep perft runs profit from a bigger table.
+    int perft_hash_mb = 512;
+
+    int search_thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    // Transposition table size in MB.
+    int hash_mb = 256;
+
     // We want to store the found move here.
-    Move engine_move_choice;
     Move engine_move_final;
     
     const float seconds_for_engine = 2;
-    int current_depth = 1;
  
     Engine engine;
+    engine.set_perft_hash_mb(perft_hash_mb);
+    engine.set_search_threads(search_thread_count);
+    engine.set_hash_mb(hash_mb);
 
     float SCALE_FACTOR = 8.f;
     int SCREEN_WIDTH = 1080;
@@ -65,7 +229,8 @@ int main()
     int64_t black_reach_board = board->position->color_reach_board(1);
     uint64_t white_reach_board = board->position->color_reach_board(0);
 
-    moves possible_moves;
+    std::unique_ptr<moves> move_list = std::make_unique<moves>();
+    moves& possible_moves = *move_list;
     possible_moves.move_count = 0;
     int last_move_count = 0;
     board->position->determine_moves(0, possible_moves);
@@ -152,7 +317,7 @@ int main()
     if(do_perft_test)
     {
         for(int depth = 1; depth <= perft_depth_limit; depth++)
-            engine.do_perft_test(depth, board->position, is_white_turn);
+            engine.do_parallel_perft_test(depth, board->position, is_white_turn, perft_thread_count, PERFT_SPLIT_DEPTH);
         return 0;
     }
 
@@ -162,7 +327,7 @@ int main()
         while(true)
         {
             board->position->print_to_terminal();
-            std::cout << "1. Do move: \n2. Do perft test. \n3. Let engine do move. \n";
+            std::cout << "1. Do move: \n2. Do perft test. \n3. Let engine do move. \n4. Do parallel perft test. \n5. Do perft scaling test. \n";
             // Initialize:
             int command;
             std::cin >> command;
@@ -198,13 +363,31 @@ int main()
                 case 3:
                     {
                         Move best_move;
-                        engine.best_move(board->position, !is_white_turn, 6, best_move);
+                        engine.best_move(board->position, 6, best_move);
+                        if(best_move.start_location == 64)
+                            break;
                         board->position->do_move(&best_move);
                         is_white_turn = !is_white_turn;
                         board->position->determine_moves(!is_white_turn, possible_moves);
                         std::cout << "Move found: " << best_move.to_string() << '\n';
                     }
                     break;
+                case 4:
+                    std::cout << "depth, threads, split depth?" << '\n';
+                    {
+                        int depth, threads, split_depth;
+                        std::cin >> depth >> threads >> split_depth;
+                        engine.do_parallel_perft_test(depth, board->position, is_white_turn, threads, split_depth);
+                    }
+                    break;
+                case 5:
+                    std::cout << "depth?" << '\n';
+                    {
+                        int depth;
+                        std::cin >> depth;
+                        engine.do_perft_scaling_test(depth, board->position, is_white_turn, perft_thread_count, PERFT_SPLIT_DEPTH);
+                    }
+                    break;
                 default:
                     break;
             }
@@ -227,56 +410,29 @@ int main()
 
         if(!is_white_turn && !do_perft_test && engine_turned_on)
         {
-            // Engine timer starts. Because our engine can start searching.
-            if(!engine_is_searching && engine.time_up)
+            if(!engine_is_searching && !move_found)
             {
-                // Start the timer.
-                engine.time_up = false;
-                start = clock();
-            }
-    
-            if(!engine_is_searching && !move_found && !engine.time_up)
-            {
-                // Engine can start. 
+                // Engine can start. It runs iterative deepening until its time is up.
                 engine_is_searching = true;
-                
-                // Call thread to use engine and find the best move for our current depth.
-                std::thread calculator(calculate_best_move, &engine, board->position, !is_white_turn, current_depth, std::ref(engine_move_choice));
+                std::thread calculator(calculate_best_move, &engine, board->position, int(seconds_for_engine * 1000), std::ref(engine_move_final));
                 calculator.detach();
             }
-            
-            // Calculate the time that has been spent so far.
-            double time_spent = double(clock() - start) / CLOCKS_PER_SEC;
-            // std::cout << "Time spent so far: " << time_spent << '\n';
-            // std::cout << "Time up (main): " << engine.time_up << '\n';
-
-            // The engine found a new best move with time left. It can try a higher depth.
-            if(seconds_for_engine - time_spent >= 0 && !engine_is_searching && move_found)
-            {
-                std::cout << "Depth: " << current_depth << std::endl;
-                // A best move was found in time, we can store this one.
-                engine_move_final = Move(engine_move_choice);
-                // Increment the search depth.
-                current_depth++;
-                // Reset move found status, lets search for a new one.
-                move_found = false;
-            }
 
-            // Time is up. Discard results of engine's current search and use the previous move that was found in time.
-            if(time_spent >= seconds_for_engine)
+            // The engine is done, do the move it found.
+            if(move_found)
             {
-                // Signal thread to stop looking.
-                engine.time_up = true;
-                // Reset search depth.
-                current_depth = 1;
-                // Do the move.
-                board->position->do_move(&engine_move_final);
-                // Switch player to move.
-                is_white_turn = !is_white_turn;
-                // Determine moves for other player.
-                // possible_moves = board->position->determine_moves(!is_white_turn);
-                // Engine is done searching.
-                engine_is_searching = false;
+                move_found = false;
+                // 64 means the engine has no legal move, the game is over.
+                if(engine_move_final.start_location == 64)
+                {
+                    engine_turned_on = false;
+                }
+                else
+                {
+                    board->position->do_move(&engine_move_final);
+                    // Switch player to move.
+                    is_white_turn = !is_white_turn;
+                }
             }
 
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -0,0 +1,43 @@
+#include "pawn_table.hpp"
+#include <cstdint>
+
+#ifndef MATERIAL_TABLE_HPP
+#define MATERIAL_TABLE_HPP
+
+// ==============================================================================================
+
+struct material_entry;
+
+// Evaluation of an endgame with a known plan, replaces the normal evaluation. In centipawns from the view of white.
+typedef int (*endgame_evaluator)(const Position& position, const material_entry& entry);
+
+// Evaluation of a material signature. The score is in centipawns from the view of white and holds the piece values,
+// the bishop pair and the imbalance terms.
+struct material_entry
+{
+    uint64_t key = ~0ULL;
+    int score = 0;
+    // Specialized evaluation of the endgame, nullptr if the normal evaluation applies.
+    endgame_evaluator evaluator = nullptr;
+    // Side with the material advantage, for the endgame evaluator.
+    bool strong_side_black = false;
+};
+
+// ==============================================================================================
+
+// Material hash table of one search thread, indexed by the material key. The material only changes on captures
+// and promotions, so a handful of entries serves a whole search. Always replaces, every thread has its own.
+struct MaterialTable
+{
+    // Entry for a key. It holds the material of the key if its key matches, otherwise it is the slot to fill.
+    material_entry* probe(uint64_t key)
+    {
+        return &entries[(key ^ key >> 23) & (MATERIAL_HASH_SIZE - 1)];
+    }
+
+    material_entry entries[MATERIAL_HASH_SIZE];
+};
+
+// ==============================================================================================
+
+#endif
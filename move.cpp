@@ -19,6 +19,7 @@ Move::Move(Move* other)
     this->moving_piece = other->moving_piece;
     this->captured_piece = other->captured_piece;
     this->previous_en_passant = other->previous_en_passant;
+    this->previous_halfmove_clock = other->previous_halfmove_clock;
     this->promotion = other->promotion;
 }
 
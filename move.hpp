@@ -36,6 +36,7 @@ struct Move
     uint8_t captured_piece = INVALID;
     uint8_t previous_en_passant;
     uint8_t previous_castling_rights;
+    uint16_t previous_halfmove_clock;
     // Move might be a castling move or engine needs to check for en passant next move.
     // 1 = white kingside, 2 = white queenside, 3 = black kingside, 4 = black queenside, 5 = engine needs to check for an passant afterwards.
     uint8_t special_cases = 0b0;
@@ -57,10 +58,34 @@ struct Move
 
 // ==============================================================================================
 
-// Moves struct, keep array with possible moves.
+// Whether two moves go between the same squares with the same promotion.
+inline bool same_move(const Move& one, const Move& two)
+{
+    return one.start_location == two.start_location && one.end_location == two.end_location && one.promotion == two.promotion;
+}
+
+// ==============================================================================================
+
+// Whether a move neither captures nor promotes. Only valid after the move was done once, which sets captured_piece.
+inline bool is_quiet(const Move& move)
+{
+    return move.captured_piece >= 12 && !move.move_takes_an_passant && move.promotion == 0;
+}
+
+// ==============================================================================================
+
+// Pack a move in 16 bits for the transposition table: start square, end square and promotion. Zero means no move.
+inline uint16_t pack_move(const Move& move)
+{
+    return move.start_location | move.end_location << 6 | move.promotion << 12;
+}
+
+// ==============================================================================================
+
+// Moves struct, keep array with possible moves. Too large for the stack, allocate it on the heap.
 typedef struct 
 {
-    Move moves[1024];
+    Move moves[MOVE_LIST_SIZE];
     int move_count;
 } moves;
 
@@ -0,0 +1,36 @@
+#include "perft_table.hpp"
+#include <cstdint>
+
+#ifndef PAWN_TABLE_HPP
+#define PAWN_TABLE_HPP
+
+// ==============================================================================================
+
+// Pawn structure of a position. The score is in centipawns from the view of white, the bitboards are indexed by is_black.
+typedef struct
+{
+    uint64_t key = 0;
+    uint64_t passed_pawns[2] = {};
+    uint64_t attack_spans[2] = {};
+    int score = 0;
+} pawn_entry;
+
+// ==============================================================================================
+
+// Pawn hash table of one search thread, indexed by the pawn key. The pawns rarely change between nodes,
+// so most evaluations find their pawn structure here. Always replaces, no locks as every thread has its own.
+struct PawnTable
+{
+    // Entry for a key. It holds the pawn structure of the key if its key matches, otherwise it is the slot to fill.
+    // A fresh entry has key 0, the key without pawns, and its empty structure is right for that.
+    pawn_entry* probe(uint64_t key)
+    {
+        return &entries[key & (PAWN_HASH_SIZE - 1)];
+    }
+
+    pawn_entry entries[PAWN_HASH_SIZE];
+};
+
+// ==============================================================================================
+
+#endif
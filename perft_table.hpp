@@ -0,0 +1,296 @@
+#include "transposition_table.hpp"
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef PERFT_TABLE_HPP
+#define PERFT_TABLE_HPP
+
+// ==============================================================================================
+
+// Perft hash entry. Data holds the node count in the upper 56 bits and the depth in the lowest 8 bits.
+// The full key is stored XOR-ed with the data word, so a half written entry from another thread fails
+// the key check instead of returning a wrong count. This lets the perft workers share the table without locks.
+typedef struct
+{
+    std::atomic<uint64_t> key_xor_data = 0;
+    std::atomic<uint64_t> data = 0;
+} perft_entry;
+
+// Entries per bucket. One bucket fills a 64 byte cache line.
+const int PERFT_BUCKET_SIZE = 4;
+
+// Bucket of entries sharing one index.
+typedef struct alignas(64)
+{
+    perft_entry entries[PERFT_BUCKET_SIZE];
+} perft_bucket;
+
+// Header of a perft cache file, the buckets follow it. A file is only reused if every field matches,
+// the zobrist check makes sure the keys in the file were made with the same key set.
+typedef struct alignas(64)
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_size;
+    uint64_t bucket_count;
+    uint64_t zobrist_check;
+} perft_file_header;
+
+// ==============================================================================================
+
+struct PerftTable
+{
+    PerftTable(int size_mb = PERFT_TABLE_MB)
+    {
+        resize(size_mb);
+    }
+
+    ~PerftTable()
+    {
+        unmap_file();
+    }
+
+    // ==============================================================================================
+
+    // Allocate the table in memory. The bucket count is rounded down to a power of two so we can mask the key.
+    void resize(int size_mb)
+    {
+        unmap_file();
+
+        uint64_t bucket_count = round_bucket_count(size_mb);
+        memory_table = std::vector<perft_bucket>(bucket_count);
+        perft_table = memory_table.data();
+        bucket_mask = bucket_count - 1;
+    }
+
+    // ==============================================================================================
+
+    // Back the table by a memory mapped file, so the counts survive the process.
+    // An existing file is reused if its header matches. An empty file, or a perft cache of another version,
+    // size or key set, is started over. Any other file is left alone, so a wrong path can not destroy data.
+    // Returns false if the file can not be mapped, the table then stays in memory.
+    bool map_file(const std::string& file_name, int size_mb, uint64_t zobrist_check)
+    {
+#ifndef _WIN32
+        uint64_t bucket_count = round_bucket_count(size_mb);
+        size_t file_size = sizeof(perft_file_header) + bucket_count * sizeof(perft_bucket);
+
+        int file = open(file_name.c_str(), O_RDWR | O_CREAT, 0644);
+        if(file < 0)
+            return false;
+
+        // Read the old header. Only an empty file or a perft cache may be written.
+        perft_file_header header = {};
+        struct stat file_stat;
+        if(fstat(file, &file_stat) != 0)
+        {
+            close(file);
+            return false;
+        }
+        bool perft_cache = pread(file, &header, sizeof(header), 0) == sizeof(header)
+            && std::string(header.magic, 8) == std::string(PERFT_FILE_MAGIC, 8);
+        if(file_stat.st_size != 0 && !perft_cache)
+        {
+            close(file);
+            return false;
+        }
+
+        bool reuse = perft_cache && uint64_t(file_stat.st_size) == file_size
+            && header.version == PERFT_FILE_VERSION
+            && header.bucket_size == sizeof(perft_bucket)
+            && header.bucket_count == bucket_count
+            && header.zobrist_check == zobrist_check;
+
+        // Truncating first zeroes every bucket of a cache we do not reuse.
+        if(!reuse && (ftruncate(file, 0) != 0 || ftruncate(file, file_size) != 0))
+        {
+            close(file);
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        close(file);
+        if(mapping == MAP_FAILED)
+            return false;
+
+        if(!reuse)
+        {
+            perft_file_header* new_header = (perft_file_header*)mapping;
+            std::copy(PERFT_FILE_MAGIC, PERFT_FILE_MAGIC + 8, new_header->magic);
+            new_header->version = PERFT_FILE_VERSION;
+            new_header->bucket_size = sizeof(perft_bucket);
+            new_header->bucket_count = bucket_count;
+            new_header->zobrist_check = zobrist_check;
+        }
+
+        unmap_file();
+        memory_table = std::vector<perft_bucket>();
+        mapped_file = mapping;
+        mapped_size = file_size;
+        perft_table = (perft_bucket*)((char*)mapping + sizeof(perft_file_header));
+        bucket_mask = bucket_count - 1;
+        reused_file = reuse;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // ==============================================================================================
+
+    // Whether the table lives in a file.
+    bool is_persistent() const
+    {
+        return mapped_file != nullptr;
+    }
+
+    // Whether the mapped file held counts of an earlier run.
+    bool reused_persistent_file() const
+    {
+        return mapped_file != nullptr && reused_file;
+    }
+
+    // ==============================================================================================
+
+    // Start loading the bucket of a key into the cache, before the probe needs it.
+    void prefetch(uint64_t key) const
+    {
+        __builtin_prefetch(&perft_table[key & bucket_mask]);
+    }
+
+    // ==============================================================================================
+
+    // Get the node count of a position searched to depth. Returns false if the position is not stored.
+    bool get_entry_nodes(int depth, uint64_t key, uint64_t& nodes)
+    {
+        perft_bucket* bucket = &perft_table[key & bucket_mask];
+
+        for(perft_entry& entry : bucket->entries)
+        {
+            uint64_t data = entry.data.load(std::memory_order_relaxed);
+            uint64_t key_xor_data = entry.key_xor_data.load(std::memory_order_relaxed);
+
+            // Check if position and depth are correct.
+            if((key_xor_data ^ data) == key && int(data & 0xFF) == depth && data != 0)
+            {
+                nodes = data >> 8;
+                return true;
+            }
+        }
+
+        // Does not exist.
+        return false;
+    }
+
+    // ==============================================================================================
+
+    // Store the node count of a position.
+    // Replaces the same position and depth if present, otherwise the shallowest entry in the bucket.
+    void insert_nodes(int depth, uint64_t key, uint64_t nodes)
+    {
+        perft_bucket* bucket = &perft_table[key & bucket_mask];
+        perft_entry* replace = &bucket->entries[0];
+        int replace_depth = 256;
+
+        for(perft_entry& entry : bucket->entries)
+        {
+            uint64_t data = entry.data.load(std::memory_order_relaxed);
+            uint64_t key_xor_data = entry.key_xor_data.load(std::memory_order_relaxed);
+            int entry_depth = data & 0xFF;
+
+            if((key_xor_data ^ data) == key && entry_depth == depth)
+            {
+                replace = &entry;
+                break;
+            }
+            if(entry_depth < replace_depth)
+            {
+                replace = &entry;
+                replace_depth = entry_depth;
+            }
+        }
+
+        uint64_t data = (nodes << 8) | (depth & 0xFF);
+
+        replace->key_xor_data.store(key ^ data, std::memory_order_relaxed);
+        replace->data.store(data, std::memory_order_relaxed);
+    }
+
+    // ==============================================================================================
+
+    // Clear table, split over thread_count threads.
+    void clear_table(int thread_count = 1)
+    {
+        for_each_slice(bucket_mask + 1, thread_count, [this](uint64_t begin, uint64_t end)
+        {
+            for(uint64_t index = begin; index < end; index++)
+            {
+                for(perft_entry& entry : perft_table[index].entries)
+                {
+                    entry.key_xor_data.store(0, std::memory_order_relaxed);
+                    entry.data.store(0, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    // ==============================================================================================
+
+    // Table size in bytes.
+    uint64_t size_bytes() const
+    {
+        return (bucket_mask + 1) * sizeof(perft_bucket);
+    }
+
+    // ==============================================================================================
+
+    // Table instance, points into memory_table or into the mapped file.
+    perft_bucket* perft_table = nullptr;
+
+    uint64_t bucket_mask = 0;
+
+private:
+
+    // Largest power of two bucket count that fits in size_mb.
+    static uint64_t round_bucket_count(int size_mb)
+    {
+        uint64_t bucket_count = 1;
+        while(bucket_count * 2 * sizeof(perft_bucket) <= uint64_t(size_mb) * 1024 * 1024)
+            bucket_count *= 2;
+        return bucket_count;
+    }
+
+    // ==============================================================================================
+
+    // Release the file mapping. The kernel writes the dirty pages back to the file.
+    void unmap_file()
+    {
+#ifndef _WIN32
+        if(mapped_file != nullptr)
+            munmap(mapped_file, mapped_size);
+#endif
+        mapped_file = nullptr;
+        mapped_size = 0;
+    }
+
+    // ==============================================================================================
+
+    std::vector<perft_bucket> memory_table;
+
+    void* mapped_file = nullptr;
+    size_t mapped_size = 0;
+    bool reused_file = false;
+};
+
+// ==============================================================================================
+
+#endif
@@ -18,6 +18,9 @@ Position::Position(const Position& other)
     this->casling_rights = other.casling_rights;
     this->en_passant = other.en_passant;
     this->white_to_turn = other.white_to_turn;
+    this->halfmove_clock = other.halfmove_clock;
+    this->fullmove_number = other.fullmove_number;
+    this->material_key = other.material_key;
 
     // Copy bitboards.
     for(uint8_t piece = W_KING; piece < 14; piece++) this->bit_boards[piece] = other.bit_boards[piece];
@@ -25,6 +28,255 @@ Position::Position(const Position& other)
 
 // ==============================================================================================
 
+// Copy assignment.
+Position& Position::operator=(const Position& other)
+{
+    // Copy contents of position.
+    this->casling_rights = other.casling_rights;
+    this->en_passant = other.en_passant;
+    this->white_to_turn = other.white_to_turn;
+    this->halfmove_clock = other.halfmove_clock;
+    this->fullmove_number = other.fullmove_number;
+    this->material_key = other.material_key;
+
+    // Copy bitboards.
+    for(uint8_t piece = W_KING; piece < 14; piece++) this->bit_boards[piece] = other.bit_boards[piece];
+
+    return *this;
+}
+
+// ==============================================================================================
+
+// Create a position from a FEN string.
+// Parses in place without streams or allocations, so bulk loading benchmark positions stays cheap.
+Position Position::from_fen(const std::string& fen)
+{
+    Position position;
+    const char* letter = fen.c_str();
+
+    auto skip_spaces = [&]()
+    {
+        while(*letter == ' ')
+            letter++;
+    };
+
+    // Piece placement. FEN starts at a8 and ends at h1, which is also our square order.
+    for(uint8_t board = W_KING; board < 14; board++) position.bit_boards[board] = 0ULL;
+
+    skip_spaces();
+    int square = 0;
+    int file = 0;
+    for(; *letter != ' ' && *letter != '\0'; letter++)
+    {
+        if(*letter == '/')
+        {
+            if(file != 8)
+                throw std::invalid_argument("Invalid rank length in FEN");
+            file = 0;
+            continue;
+        }
+        if(*letter >= '1' && *letter <= '8')
+        {
+            square += *letter - '0';
+            file += *letter - '0';
+            continue;
+        }
+
+        uint8_t piece = fen_letter_to_piece(*letter);
+        if(piece == INVALID || file >= 8 || square >= 64)
+            throw std::invalid_argument("Invalid piece placement in FEN");
+
+        uint64_t mask = 1ULL << (63 - square);
+        position.bit_boards[piece] |= mask;
+        position.bit_boards[TOTAL] |= mask;
+        if(piece > 5)
+            position.bit_boards[COLOR_BOARD] |= mask;
+        square++;
+        file++;
+    }
+    if(square != 64 || file != 8)
+        throw std::invalid_argument("Invalid piece placement in FEN");
+
+    // Search and evaluation need one king per side and pawns between the second and seventh rank.
+    // The material key counts every piece in 4 bits, so at most 15 of a kind.
+    if(__builtin_popcountll(position.bit_boards[W_KING]) != 1 || __builtin_popcountll(position.bit_boards[B_KING]) != 1)
+        throw std::invalid_argument("FEN needs exactly one king per side");
+    if((position.bit_boards[W_PAWN] | position.bit_boards[B_PAWN]) & 0xFF000000000000FFULL)
+        throw std::invalid_argument("Pawn on the first or last rank in FEN");
+    for(uint8_t piece = W_QUEEN; piece < 12; piece++)
+    {
+        if(__builtin_popcountll(position.bit_boards[piece]) > 15)
+            throw std::invalid_argument("More than 15 pieces of a kind in FEN");
+    }
+    position.material_key = position.compute_material_key();
+
+    // Player at turn.
+    skip_spaces();
+    if(*letter != 'w' && *letter != 'b')
+        throw std::invalid_argument("Invalid side to move in FEN");
+    position.white_to_turn = *letter++ == 'w';
+
+    // Castling rights. From left to right: white kingside, white queenside, black kingside, black queenside.
+    skip_spaces();
+    position.casling_rights = 0b0000'0000;
+    if(*letter == '-')
+    {
+        letter++;
+    }
+    else
+    {
+        for(; *letter != ' ' && *letter != '\0'; letter++)
+        {
+            switch(*letter)
+            {
+                case 'K': position.casling_rights |= 0b1000; break;
+                case 'Q': position.casling_rights |= 0b0100; break;
+                case 'k': position.casling_rights |= 0b0010; break;
+                case 'q': position.casling_rights |= 0b0001; break;
+                default: throw std::invalid_argument("Invalid castling rights in FEN");
+            }
+        }
+    }
+
+    // Move generation trusts the castling rights, so the king and rook of every right must be on their squares.
+    // King and rook square per right, from white kingside to black queenside.
+    const int castling_squares[4][2] = {{60, 63}, {60, 56}, {4, 7}, {4, 0}};
+    for(int right = 0; right < 4; right++)
+    {
+        int black = right >= 2;
+        if((position.casling_rights & (0b1000 >> right)) && (position.get_piece(castling_squares[right][0]) != W_KING + 6 * black
+            || position.get_piece(castling_squares[right][1]) != W_ROOK + 6 * black))
+            throw std::invalid_argument("Castling rights without king and rook on their squares in FEN");
+    }
+
+    // En passant. FEN gives the square behind the pawn that just moved, 
+    // we only store it if a pawn of the player at turn stands next to that pawn.
+    skip_spaces();
+    position.en_passant = 0b00000000;
+    if(*letter == '-')
+    {
+        letter++;
+    }
+    else
+    {
+        if(letter[0] < 'a' || letter[0] > 'h' || letter[1] != (position.white_to_turn ? '6' : '3'))
+            throw std::invalid_argument("Invalid en passant square in FEN");
+
+        uint8_t target_file = letter[0] - 'a';
+        uint8_t pawn_row = position.white_to_turn ? 3 : 4;
+        uint8_t capturing_pawn = position.white_to_turn ? W_PAWN : B_PAWN;
+        letter += 2;
+
+        if(target_file != 0 && position.get_piece(pawn_row * 8 + target_file - 1) == capturing_pawn)
+            position.en_passant |= EN_PASSANT_LEFT;
+        if(target_file != 7 && position.get_piece(pawn_row * 8 + target_file + 1) == capturing_pawn)
+            position.en_passant |= EN_PASSANT_RIGHT;
+
+        if(position.en_passant != 0b00000000)
+        {
+            position.en_passant += target_file;
+            // Pawn that can be captured is black.
+            if(position.white_to_turn)
+                position.en_passant |= 0b00100000;
+        }
+    }
+
+    // Move clocks are optional, EPD lines leave them out.
+    auto read_number = [&](uint16_t& number)
+    {
+        skip_spaces();
+        if(*letter < '0' || *letter > '9')
+            return;
+        number = 0;
+        for(; *letter >= '0' && *letter <= '9'; letter++)
+            number = number * 10 + (*letter - '0');
+    };
+    read_number(position.halfmove_clock);
+    read_number(position.fullmove_number);
+
+    return position;
+}
+
+// ==============================================================================================
+
+// Write the position as a FEN string.
+std::string Position::to_fen() const
+{
+    std::string fen;
+    fen.reserve(96);
+
+    // Piece placement.
+    for(int row = 0; row < 8; row++)
+    {
+        int empty_squares = 0;
+        for(int file = 0; file < 8; file++)
+        {
+            uint8_t piece = get_piece(row * 8 + file);
+            if(piece == EMPTY)
+            {
+                empty_squares++;
+                continue;
+            }
+            if(empty_squares > 0)
+                fen += char('0' + empty_squares);
+            empty_squares = 0;
+            fen += "KQRBNPkqrbnp"[piece];
+        }
+        if(empty_squares > 0)
+            fen += char('0' + empty_squares);
+        if(row != 7)
+            fen += '/';
+    }
+
+    // Player at turn.
+    fen += white_to_turn ? " w " : " b ";
+
+    // Castling rights.
+    if(casling_rights == 0b0000'0000)
+        fen += '-';
+    if(casling_rights & 0b1000) fen += 'K';
+    if(casling_rights & 0b0100) fen += 'Q';
+    if(casling_rights & 0b0010) fen += 'k';
+    if(casling_rights & 0b0001) fen += 'q';
+
+    // En passant target square, behind the pawn that can be captured.
+    fen += ' ';
+    if(en_passant == 0b00000000)
+    {
+        fen += '-';
+    }
+    else
+    {
+        uint8_t target_row = (en_passant & 0b00100000) ? 2 : 5;
+        fen += make_chess_notation(target_row * 8 + (en_passant & 0b00000111));
+    }
+
+    // Move clocks.
+    fen += ' ' + std::to_string(halfmove_clock) + ' ' + std::to_string(fullmove_number);
+
+    return fen;
+}
+
+// ==============================================================================================
+
+// Compare the state of two positions.
+bool Position::operator==(const Position& other) const
+{
+    for(uint8_t piece = W_KING; piece < 14; piece++)
+    {
+        if(bit_boards[piece] != other.bit_boards[piece])
+            return false;
+    }
+
+    return white_to_turn == other.white_to_turn 
+        && casling_rights == other.casling_rights 
+        && en_passant == other.en_passant
+        && halfmove_clock == other.halfmove_clock
+        && fullmove_number == other.fullmove_number;
+}
+
+// ==============================================================================================
+
 // Destructor.
 Position::~Position() {}
 
@@ -87,6 +339,172 @@ uint64_t Position::color_reach_board(bool is_black)
 
 // ==============================================================================================
 
+// Pieces of both colors that attack a square. Sliders are looked up with the given occupancy,
+// so removing a piece from it reveals the x-ray attackers behind that piece.
+uint64_t Position::attackers_to(uint8_t square, uint64_t occupancy) const
+{
+    uint64_t diagonal_sliders = bit_boards[W_BISHOP] | bit_boards[B_BISHOP] | bit_boards[W_QUEEN] | bit_boards[B_QUEEN];
+    uint64_t straight_sliders = bit_boards[W_ROOK] | bit_boards[B_ROOK] | bit_boards[W_QUEEN] | bit_boards[B_QUEEN];
+
+    // A white pawn attacks the square if a black pawn on the square would attack the white pawn, and the other way around.
+    return (PAWN_ATTACK_SQUARES[1][square] & bit_boards[W_PAWN])
+        | (PAWN_ATTACK_SQUARES[0][square] & bit_boards[B_PAWN])
+        | (KNIGHT_MOVE_SQUARES[square] & (bit_boards[W_KNIGHT] | bit_boards[B_KNIGHT]))
+        | (KING_MOVE_SQUARES[square] & (bit_boards[W_KING] | bit_boards[B_KING]))
+        | (get_bishop_move(square, false, occupancy, 0) & diagonal_sliders)
+        | (get_rook_move(square, false, occupancy, 0) & straight_sliders);
+}
+
+// ==============================================================================================
+
+// Least valuable piece of a player among the attackers. Sets attacker_bit to its square and returns
+// the piece type, or EMPTY if the player has no attacker left.
+static inline uint8_t least_valuable_attacker(const uint64_t* bit_boards, uint64_t attackers, bool is_black, uint64_t& attacker_bit)
+{
+    for(int piece_type = W_PAWN; piece_type >= W_KING; piece_type--)
+    {
+        uint64_t board = attackers & bit_boards[piece_type + 6 * is_black];
+        if(board)
+        {
+            attacker_bit = board & -board;
+            return piece_type;
+        }
+    }
+    return EMPTY;
+}
+
+// ==============================================================================================
+
+// First capture of an exchange: the value it takes, the value of the piece it leaves on the target square,
+// and the occupancy after it. En passant removes the pawn beside the target square, a promotion gains the new piece.
+static inline void see_first_capture(const Position& position, const Move& move, int& captured_value, int& piece_value, uint64_t& occupancy)
+{
+    uint8_t victim = position.get_piece(move.end_location);
+    captured_value = victim != EMPTY ? SEE_VALUE[victim % 6] : 0;
+    piece_value = SEE_VALUE[move.moving_piece % 6];
+    occupancy = position.bit_boards[TOTAL] & ~(1ULL << (63 - move.start_location));
+
+    if(move.move_takes_an_passant)
+    {
+        captured_value = SEE_VALUE[W_PAWN];
+        occupancy &= ~(1ULL << (63 - (move.start_location / 8 * 8 + move.end_location % 8)));
+    }
+    if(move.promotion != 0)
+    {
+        captured_value += SEE_VALUE[move.promotion] - SEE_VALUE[W_PAWN];
+        piece_value = SEE_VALUE[move.promotion];
+    }
+}
+
+// ==============================================================================================
+
+// Static exchange evaluation with a swap list. Both players keep capturing on the target square with their least
+// valuable attacker, then the list is folded back because either player may stop capturing when that is better.
+// Pins are ignored. The list lives on the stack, an exchange has at most 32 captures.
+int Position::see(const Move& move) const
+{
+    uint8_t square = move.end_location;
+    int gain[32];
+    int piece_value;
+    uint64_t occupancy;
+    see_first_capture(*this, move, gain[0], piece_value, occupancy);
+
+    uint64_t diagonal_sliders = bit_boards[W_BISHOP] | bit_boards[B_BISHOP] | bit_boards[W_QUEEN] | bit_boards[B_QUEEN];
+    uint64_t straight_sliders = bit_boards[W_ROOK] | bit_boards[B_ROOK] | bit_boards[W_QUEEN] | bit_boards[B_QUEEN];
+    uint64_t attackers = attackers_to(square, occupancy) & occupancy;
+
+    bool is_black = move.moving_piece > 5;
+    int depth = 0;
+    while(true)
+    {
+        is_black = !is_black;
+        uint64_t attacker_bit;
+        uint8_t piece_type = least_valuable_attacker(bit_boards, attackers, is_black, attacker_bit);
+        if(piece_type == EMPTY)
+            break;
+
+        // The king can not take on a square the opponent still attacks.
+        uint64_t enemy_pieces = is_black ? ~bit_boards[COLOR_BOARD] : bit_boards[COLOR_BOARD];
+        if(piece_type == W_KING && (attackers & enemy_pieces))
+            break;
+
+        depth++;
+        gain[depth] = piece_value - gain[depth - 1];
+        piece_value = SEE_VALUE[piece_type];
+
+        // Remove the attacker and add the sliders it was blocking.
+        occupancy &= ~attacker_bit;
+        attackers |= (get_bishop_move(square, false, occupancy, 0) & diagonal_sliders) 
+            | (get_rook_move(square, false, occupancy, 0) & straight_sliders);
+        attackers &= occupancy;
+    }
+
+    for(; depth > 0; depth--)
+        gain[depth - 1] = -std::max(-gain[depth - 1], gain[depth]);
+
+    return gain[0];
+}
+
+// ==============================================================================================
+
+// Whether see(move) >= threshold, without building the swap list. The balance is kept from the view of the
+// player whose turn it is in the exchange, so it can stop as soon as the outcome can not change anymore.
+bool Position::see_ge(const Move& move, int threshold) const
+{
+    uint8_t square = move.end_location;
+    int captured_value;
+    int piece_value;
+    uint64_t occupancy;
+    see_first_capture(*this, move, captured_value, piece_value, occupancy);
+
+    // Even if the opponent does not recapture, the capture is not enough.
+    int balance = captured_value - threshold;
+    if(balance < 0)
+        return false;
+
+    // Even if the opponent takes our piece for free, we are still above the threshold.
+    balance = piece_value - balance;
+    if(balance <= 0)
+        return true;
+
+    uint64_t diagonal_sliders = bit_boards[W_BISHOP] | bit_boards[B_BISHOP] | bit_boards[W_QUEEN] | bit_boards[B_QUEEN];
+    uint64_t straight_sliders = bit_boards[W_ROOK] | bit_boards[B_ROOK] | bit_boards[W_QUEEN] | bit_boards[B_QUEEN];
+    uint64_t attackers = attackers_to(square, occupancy) & occupancy;
+
+    bool is_black = move.moving_piece > 5;
+    bool result = true;
+    while(true)
+    {
+        is_black = !is_black;
+        uint64_t attacker_bit;
+        uint8_t piece_type = least_valuable_attacker(bit_boards, attackers, is_black, attacker_bit);
+        if(piece_type == EMPTY)
+            break;
+
+        result = !result;
+
+        // A king capture only stands if the opponent has no attacker left.
+        if(piece_type == W_KING)
+        {
+            uint64_t enemy_pieces = is_black ? ~bit_boards[COLOR_BOARD] : bit_boards[COLOR_BOARD];
+            return (attackers & enemy_pieces) ? !result : result;
+        }
+
+        balance = SEE_VALUE[piece_type] - balance;
+        if(balance < result)
+            break;
+
+        occupancy &= ~attacker_bit;
+        attackers |= (get_bishop_move(square, false, occupancy, 0) & diagonal_sliders) 
+            | (get_rook_move(square, false, occupancy, 0) & straight_sliders);
+        attackers &= occupancy;
+    }
+
+    return result;
+}
+
+// ==============================================================================================
+
 // Check if the king is in check.
 bool Position::king_under_attack(bool is_black, uint64_t enemy_reach)
 {
@@ -99,6 +517,19 @@ bool Position::king_under_attack(bool is_black, uint64_t enemy_reach)
 
 // ==============================================================================================
 
+// Check if the king is in check by looking at the attackers of its square only.
+bool Position::king_in_check(bool is_black) const
+{
+    uint64_t king_board = bit_boards[W_KING + 6 * is_black];
+    if(king_board == 0)
+        return false;
+
+    uint64_t enemy_pieces = is_black ? ~bit_boards[COLOR_BOARD] : bit_boards[COLOR_BOARD];
+    return boards_intersect(attackers_to(__builtin_clzll(king_board), bit_boards[TOTAL]), enemy_pieces);
+}
+
+// ==============================================================================================
+
 // Execute a move.
 void Position::do_move(Move* move)
 {
@@ -118,6 +549,56 @@ void Position::do_move(Move* move)
         bit_boards[move->moving_piece] &= ~mask;
         bit_boards[move->promotion + 6*(move->moving_piece > 5)] |= mask;
     }
+    material_key += material_key_change(move);
+    update_move_clocks(move);
+}
+
+// ==============================================================================================
+
+// Material key of the board: the count of every piece, packed in 4 bits each.
+uint64_t Position::compute_material_key() const
+{
+    uint64_t key = 0;
+    for(uint8_t piece = W_KING; piece < 12; piece++)
+        key += __builtin_popcountll(bit_boards[piece]) * MATERIAL_KEY_UNIT(piece);
+    return key;
+}
+
+// ==============================================================================================
+
+// Change of the material key by a move: captures remove a piece, promotions turn a pawn into another piece.
+uint64_t Position::material_key_change(const Move* move) const
+{
+    bool is_black = move->moving_piece > 5;
+    uint64_t change = 0;
+
+    if(move->move_takes_an_passant)
+        change -= MATERIAL_KEY_UNIT(W_PAWN + 6 * !is_black);
+    else if(move->captured_piece < 12)
+        change -= MATERIAL_KEY_UNIT(move->captured_piece);
+
+    if(move->promotion > 0)
+        change += MATERIAL_KEY_UNIT(move->promotion + 6 * is_black) - MATERIAL_KEY_UNIT(move->moving_piece);
+    return change;
+}
+
+// ==============================================================================================
+
+// Pass the turn. A pawn that could be taken en passant can not be taken anymore after it.
+void Position::do_null_move(Move* move)
+{
+    move->previous_en_passant = en_passant;
+    reset_en_passant_status();
+    white_to_turn = !white_to_turn;
+}
+
+// ==============================================================================================
+
+// Take back a pass.
+void Position::undo_null_move(Move* move)
+{
+    en_passant = move->previous_en_passant;
+    white_to_turn = !white_to_turn;
 }
 
 // ============================================================================================== 
@@ -125,6 +606,7 @@ void Position::do_move(Move* move)
 // Handle the undo logic for a move.
 void Position::undo_move(Move* move)
 { 
+    material_key -= material_key_change(move);
     if(move->promotion > 0)
     {
         uint64_t mask = 1ULL << (63-move->end_location);
@@ -139,7 +621,30 @@ void Position::undo_move(Move* move)
     
     restore_special_cases(move);
     restore_en_passant_and_castling(move);
-    // Promotion from pawn to different piece.
+    restore_move_clocks(move);
+}
+
+// ============================================================================================== 
+
+// Pass the turn and update the move clocks. Pawn moves and captures reset the halfmove clock.
+void Position::update_move_clocks(Move* move)
+{
+    move->previous_halfmove_clock = halfmove_clock;
+    bool resets_clock = move->moving_piece == W_PAWN || move->moving_piece == B_PAWN 
+        || move->move_takes_an_passant || move->captured_piece < 12;
+    halfmove_clock = resets_clock ? 0 : halfmove_clock + 1;
+    fullmove_number += move->moving_piece > 5;
+    white_to_turn = !white_to_turn;
+}
+
+// ============================================================================================== 
+
+// Give the turn back and restore the move clocks.
+void Position::restore_move_clocks(Move* move)
+{
+    halfmove_clock = move->previous_halfmove_clock;
+    fullmove_number -= move->moving_piece > 5;
+    white_to_turn = !white_to_turn;
 }
 
 // ============================================================================================== 
@@ -258,7 +763,7 @@ void Position::restore_special_cases(Move* move)
             bit_boards[W_ROOK] |= bit_mask;
             bit_boards[TOTAL] |= bit_mask;
         }
-        else 
+        else if (move->end_location == 62)
         {   // White kingside.
             uint64_t bit_mask = 1ULL << 2;
             bit_boards[W_ROOK] &= ~bit_mask;
@@ -337,16 +842,17 @@ void Position::move_piece(Move* move)
             casling_rights &= ~(mask << 2);
     }
     // Update castling rights if a rook was moved or captured.
-    else if(moved_piece == W_ROOK || moved_piece == B_ROOK || captured_piece == W_ROOK || captured_piece == B_ROOK)
+    if(moved_piece == W_ROOK || moved_piece == B_ROOK || captured_piece == W_ROOK || captured_piece == B_ROOK)
     {
+        // A rook leaving or being captured on its corner square loses that side's right.
         uint8_t mask = 1ULL;
-        if(end_square == 0)
+        if(end_square == 0 || start_square == 0)
             casling_rights &= ~(mask);
-        else if(end_square == 7)
+        if(end_square == 7 || start_square == 7)
             casling_rights &= ~(mask << 1);
-        else if(end_square == 56)
+        if(end_square == 56 || start_square == 56)
             casling_rights &= ~(mask << 2);
-        else if(end_square == 63)
+        if(end_square == 63 || start_square == 63)
             casling_rights &= ~(mask << 3);
     }
 }
@@ -555,6 +1061,40 @@ void Position::determine_moves(bool is_black, moves& possible_moves)
 
 // ==============================================================================================
 
+// Generate captures, en passant and promotions only. Used by the quiescence search.
+void Position::determine_captures(bool is_black, moves& possible_moves)
+{
+    uint64_t enemy_reach = color_reach_board(!is_black);            
+    uint64_t own_pieces = (bit_boards[COLOR_BOARD] & -is_black) | ((~bit_boards[COLOR_BOARD] & bit_boards[TOTAL]) & ~(-is_black));
+    uint64_t enemy_pieces = bit_boards[TOTAL] & ~own_pieces;
+    // White promotes on the 8th rank (squares 0-7), black on the 1st (squares 56-63).
+    uint64_t promotion_rank = is_black ? 0xFFULL : 0xFFULL << 56;
+
+    for(int piece_type = (0 + 6*is_black); piece_type < (12 - 6*!is_black); piece_type++)
+    {
+        uint64_t board = bit_boards[piece_type] & own_pieces;
+        bool is_pawn = piece_type == W_PAWN + 6*is_black;
+        
+        while(__builtin_popcountll(board) >= 1)
+        {
+            uint8_t square = __builtin_clzll(board);
+        
+            uint64_t move_squares = make_reach_board(square, is_black, piece_type);
+            move_squares &= ~own_pieces & (is_pawn ? enemy_pieces | promotion_rank : enemy_pieces);
+
+            // Generate moves for the piece.
+            (this->*move_functions[is_pawn])(square, piece_type, move_squares, is_black, enemy_reach, possible_moves);
+
+            board &= ~(1ULL << (63 - square));
+        }
+    }
+
+    // Check en passant.
+    generate_en_passant_move(is_black, possible_moves);
+}
+
+// ==============================================================================================
+
 // Generate regular moves.
 void Position::generate_piece_moves(int pos, uint8_t piece_type, uint64_t move_squares, bool is_black, uint64_t enemy_reach, moves& possible_moves)
 {
@@ -693,6 +1233,7 @@ void Position::generate_castling_moves(bool is_black, uint64_t enemy_reach, move
             Move move(4, 6);
             move.moving_piece = B_KING;
             move.special_cases = 3;
+            move.previous_castling_rights = casling_rights;
             assert(move.moving_piece < 12);
             if(move.move_bounds_valid())
                 possible_moves.moves[possible_moves.move_count++] = move;
@@ -709,6 +1250,7 @@ void Position::generate_castling_moves(bool is_black, uint64_t enemy_reach, move
             Move move(60, 62);
             move.moving_piece = W_KING;
             move.special_cases = 1;
+            move.previous_castling_rights = casling_rights;
             assert(move.moving_piece < 12);
             if(move.move_bounds_valid())
                 possible_moves.moves[possible_moves.move_count++] = move;
@@ -721,11 +1263,12 @@ void Position::generate_castling_moves(bool is_black, uint64_t enemy_reach, move
         uint64_t check_test2 = check_test << 1;
         // Black queenside castling.
         if (get_piece(1) == EMPTY && get_piece(2) == EMPTY && get_piece(3) == EMPTY
-            && !king_look_around(is_black, 1) && !king_look_around(is_black, 2) && !king_look_around(is_black, 3))
+            && !king_look_around(is_black, 2) && !king_look_around(is_black, 3))
         {
             Move move(4, 2);
             move.moving_piece = B_KING;
             move.special_cases = 4;
+            move.previous_castling_rights = casling_rights;
             assert(move.moving_piece < 12);
             if(move.move_bounds_valid())
                 possible_moves.moves[possible_moves.move_count++] = move;
@@ -737,11 +1280,12 @@ void Position::generate_castling_moves(bool is_black, uint64_t enemy_reach, move
         uint64_t check_test2 = check_test << 1;
         // White queenside castling.
         if (get_piece(59) == EMPTY && get_piece(58) == EMPTY && get_piece(57) == EMPTY
-            && !king_look_around(is_black, 59) && !king_look_around(is_black, 58) && !king_look_around(is_black, 57))
+            && !king_look_around(is_black, 59) && !king_look_around(is_black, 58))
         {
             Move move(60, 58);
             move.moving_piece = W_KING;
             move.special_cases = 2;
+            move.previous_castling_rights = casling_rights;
             assert(move.moving_piece < 12);
             if(move.move_bounds_valid())
                 possible_moves.moves[possible_moves.move_count++] = move;
@@ -785,6 +1329,7 @@ void Position::generate_en_passant_move(bool is_black, moves& possible_moves)
         move->end_location = end_square;
         move->moving_piece = W_PAWN + 6 * is_black;
         move->move_takes_an_passant = true;
+        move->special_cases = 0b0;
         move->previous_castling_rights = casling_rights;
         move->previous_en_passant = en_passant;
         move->promotion = 0;
@@ -20,12 +20,26 @@ struct Position
     ~Position();
     // Copy constructor.
     Position(const Position& other);
+    // Copy assignment, copies the same state as the copy constructor.
+    Position& operator=(const Position& other);
+
+    // Create a position from a FEN string. Throws std::invalid_argument if the FEN can not be read, or if it does not
+    // have one king per side, has pawns on the first or last rank, more than 15 pieces of a kind, or castling rights
+    // without the king and rook on their squares.
+    static Position from_fen(const std::string& fen);
+    // Write the position as a FEN string.
+    std::string to_fen() const;
+
+    // Compare board, player at turn, castling, en passant and move clocks.
+    bool operator==(const Position& other) const;
 
     // ==============================================================================================
 
     // Move generation functions.
     // Determine possible moves.
     void determine_moves(bool color_sign, moves& moves);
+    // Determine captures, en passant and promotions.
+    void determine_captures(bool color_sign, moves& moves);
     // Generate moves for a piece.
     void generate_piece_moves(int pos, uint8_t piece_type, uint64_t move_squares, bool is_black, uint64_t enemy_reach, moves& moves);
     // Generate moves for a pawn.
@@ -49,6 +63,7 @@ struct Position
     void reset_en_passant_status();
     void handle_en_passant_capture(Move* move);
     void move_piece(Move* move);
+    void update_move_clocks(Move* move);
 
     // ==============================================================================================
 
@@ -58,11 +73,27 @@ struct Position
     void undo_en_passant_capture(Move* move);
     void restore_special_cases(Move* move);
     void restore_en_passant_and_castling(Move* move);
+    void restore_move_clocks(Move* move);
+
+    // ==============================================================================================
+
+    // Material key of the board, updated by do_move and undo_move.
+    uint64_t compute_material_key() const;
+    // Change of the material key by a move. Only valid after the move was done, which sets captured_piece.
+    uint64_t material_key_change(const Move* move) const;
+
+    // ==============================================================================================
+
+    // Null move for null move pruning: the player at turn passes. The move keeps the en passant status to restore.
+    void do_null_move(Move* move);
+    void undo_null_move(Move* move);
 
     // ==============================================================================================
 
     // Check if king is under attack.
     bool king_under_attack(bool color_sign, uint64_t enemy_reach);
+    // Check if king is under attack without an attack board of the opponent.
+    bool king_in_check(bool is_black) const;
     bool king_look_around(bool is_black, uint8_t square);
     bool move_legal(Move* move, uint64_t move_squares, bool is_black, uint64_t enemy_reach);
 
@@ -75,6 +106,16 @@ struct Position
 
     // ==============================================================================================
 
+    // Static exchange evaluation.
+    // Pieces of both colors that attack a square with the given occupancy.
+    uint64_t attackers_to(uint8_t square, uint64_t occupancy) const;
+    // Material balance in centipawns of the exchange a move starts on its target square.
+    int see(const Move& move) const;
+    // Whether the exchange a move starts wins at least threshold centipawns.
+    bool see_ge(const Move& move, int threshold) const;
+
+    // ==============================================================================================
+
     // Function arrays.
     generator_function generators[6] = 
     {
@@ -133,6 +174,13 @@ struct Position
     // Second bit is the color sign of the pawn that can be captured.
     // Furthermore, the right most bits indicate the file on which an passant is captured.
     uint8_t en_passant = 0b00000000;
+
+    // Plies since the last capture or pawn move, and the move number. Only used for FEN.
+    uint16_t halfmove_clock = 0;
+    uint16_t fullmove_number = 1;
+
+    // Count of every piece, see MATERIAL_KEY_UNIT. The index of the material hash table.
+    uint64_t material_key = compute_material_key();
     
 };
 
@@ -0,0 +1,118 @@
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <atomic>
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+// ==============================================================================================
+
+// Task for the pool. Receives the index of the worker that runs it, so tasks can use per worker data.
+typedef std::function<void(int)> pool_task;
+
+// ==============================================================================================
+
+// Pool of worker threads where every worker owns a task queue.
+// A worker takes tasks from the back of its own queue. When that queue runs dry,
+// it steals from the front of the other queues, so uneven subtrees get balanced out.
+struct WorkStealingPool
+{
+    WorkStealingPool(int thread_count) : task_queues(thread_count) {}
+
+    // ==============================================================================================
+
+    // Add a task to the queue of a worker.
+    void push_task(int worker, pool_task task)
+    {
+        task_queue& queue = task_queues[worker % task_queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    // ==============================================================================================
+
+    // Start the workers and block until every queued task is done.
+    void run()
+    {
+        std::vector<std::thread> workers;
+        for(size_t worker = 0; worker < task_queues.size(); worker++)
+            workers.emplace_back(&WorkStealingPool::work, this, worker);
+
+        for(std::thread& worker : workers)
+            worker.join();
+    }
+
+    // ==============================================================================================
+
+    // Number of tasks that were taken from another worker's queue during the last run.
+    uint64_t stolen_task_count() const
+    {
+        return steal_count;
+    }
+
+private:
+
+    // Queue of tasks owned by a single worker.
+    struct task_queue
+    {
+        std::mutex lock;
+        std::deque<pool_task> tasks;
+    };
+
+    // ==============================================================================================
+
+    // Worker loop. All tasks are queued before run(), so a worker is done once it finds nothing to steal.
+    void work(int worker)
+    {
+        pool_task task;
+        while(pop_task(worker, task) || steal_task(worker, task))
+            task(worker);
+    }
+
+    // ==============================================================================================
+
+    // Take the newest task from our own queue.
+    bool pop_task(int worker, pool_task& task)
+    {
+        task_queue& queue = task_queues[worker];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if(queue.tasks.empty())
+            return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    // ==============================================================================================
+
+    // Take the oldest task of another worker, starting with our neighbour.
+    bool steal_task(int worker, pool_task& task)
+    {
+        for(size_t offset = 1; offset < task_queues.size(); offset++)
+        {
+            task_queue& queue = task_queues[(worker + offset) % task_queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if(queue.tasks.empty())
+                continue;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            steal_count++;
+            return true;
+        }
+        return false;
+    }
+
+    // ==============================================================================================
+
+    std::vector<task_queue> task_queues;
+
+    std::atomic<uint64_t> steal_count = 0;
+};
+
+// ==============================================================================================
+
+#endif
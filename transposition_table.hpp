@@ -3,95 +3,552 @@
 #include <unordered_map>
 #include <optional>
 #include <random>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #ifndef TT_HPP
 #define TT_HPP
 
-// Data structure for the transposition table.
-typedef struct 
+// Split count items into thread_count slices and run work(begin, end) on every slice, one thread per slice.
+// The calling thread takes the first slice. Used to clear and first touch the tables in parallel.
+template<typename Work>
+void for_each_slice(uint64_t count, int thread_count, Work work)
 {
-    uint64_t key = no_hash_entry;
-    int depth;
-    int flags;
-    int score;
-    int sub_nodes;
-} tt;
+    thread_count = int(std::max<uint64_t>(std::min<uint64_t>(thread_count, count), 1));
+
+    std::vector<std::thread> workers;
+    for(int slice = 1; slice < thread_count; slice++)
+        workers.emplace_back(work, count * slice / thread_count, count * (slice + 1) / thread_count);
+    work(0, count / thread_count);
+    for(std::thread& worker : workers)
+        worker.join();
+}
+
+// Entries per bucket. Six 10 byte entries fill a 64 byte cache line, so a probe touches one line.
+const int TT_BUCKET_SIZE = 6;
+
+// Bucket of the transposition table. Every entry is a 16 bit key check and a data word:
+// the packed best move in bits 0-15, the score in bits 16-31, the depth in bits 32-39, the flag in bits 40-41,
+// the generation of the search that stored it in bits 42-47, bit 48 marks a used entry and bits 49-63 hold key bits 33-47.
+// Entries are written and read without locks. The top 16 bits of the key are stored XOR-ed with a fold of the data word,
+// so when search threads write the same entry at once, a key check from one write and a data word from another
+// fail the check instead of returning the data of another position. With the key bits in the data word,
+// 31 key bits are checked on top of the bucket index.
+typedef struct alignas(64)
+{
+    std::atomic<uint16_t> keys[TT_BUCKET_SIZE];
+    std::atomic<uint64_t> data[TT_BUCKET_SIZE];
+} tt_bucket;
+
+// Header of a transposition table file, the buckets follow it. A file is only loaded if the format matches
+// and the zobrist check makes sure the keys in the file were made with the same key set.
+typedef struct alignas(64)
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_size;
+    uint64_t bucket_count;
+    uint64_t zobrist_check;
+    uint8_t generation;
+} tt_file_header;
+
+// Header of a shared memory transposition table, the buckets follow it. The generation is shared as well,
+// so a new search in any process ages the entries of all of them.
+typedef struct alignas(64)
+{
+    std::atomic<uint32_t> ready;
+    uint32_t version;
+    uint32_t bucket_size;
+    uint64_t bucket_count;
+    uint64_t zobrist_check;
+    std::atomic<uint32_t> generation;
+} tt_shared_header;
 
 struct TranspositionTable
 {
-    TranspositionTable() : transposition_table(hash_table_size) {
-        clear_table(); // Ensure the table is initialized with invalid entries.
+    TranspositionTable(int size_mb = HASH_TABLE_MB)
+    {
+        resize(size_mb, 1);
+    }
+
+    ~TranspositionTable()
+    {
+        release();
+    }
+
+    // Allocate the table. The bucket count is rounded down to a power of two so we can mask the key.
+    // Anonymous mappings start zeroed, which is an empty table, so nothing has to be cleared.
+    // The pages are first touched by thread_count temporary threads, each taking a slice. The threads are not
+    // pinned, so on NUMA hosts this spreads the table over the nodes the scheduler puts them on instead of
+    // landing all of it on the node of the calling thread. It does not place pages next to a search thread.
+    void resize(int size_mb, int thread_count)
+    {
+        release();
+
+        uint64_t bucket_count = round_bucket_count(size_mb);
+        size_t table_size = bucket_count * sizeof(tt_bucket);
+
+#ifndef _WIN32
+        // Reserved huge pages first. Without them, align a normal mapping to the huge page size
+        // and ask for transparent huge pages.
+        void* mapping = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if(table_size % HUGE_PAGE_SIZE == 0)
+        {
+            mapping = mmap(nullptr, table_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if(mapping != MAP_FAILED)
+            {
+                mapped_memory = mapping;
+                mapped_size = table_size;
+                transposition_table = (tt_bucket*)mapping;
+            }
+        }
+#endif
+        if(mapping == MAP_FAILED)
+        {
+            size_t alignment = table_size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 0;
+            mapping = mmap(nullptr, table_size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(mapping == MAP_FAILED)
+                throw std::bad_alloc();
+
+            mapped_memory = mapping;
+            mapped_size = table_size + alignment;
+            uintptr_t start = (uintptr_t)mapping;
+            if(alignment != 0)
+                start = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            transposition_table = (tt_bucket*)start;
+#ifdef MADV_HUGEPAGE
+            madvise(transposition_table, table_size, MADV_HUGEPAGE);
+#endif
+        }
+#else
+        memory_table = std::vector<tt_bucket>(bucket_count);
+        transposition_table = memory_table.data();
+#endif
+        bucket_mask = bucket_count - 1;
+
+        first_touch(thread_count);
+    }
+
+    // Write the table to a file, so a later run can load it and continue warm. Returns false if the file can not be written.
+    // The table is written to a temporary file that then replaces the old one, the table may still be mapped from it.
+    bool save_file(const std::string& file_name, uint64_t zobrist_check) const
+    {
+#ifndef _WIN32
+        size_t file_size = sizeof(tt_file_header) + size_bytes();
+        std::string temporary_name = file_name + ".tmp";
+
+        int file = open(temporary_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(file < 0)
+            return false;
+        if(ftruncate(file, file_size) != 0)
+        {
+            close(file);
+            unlink(temporary_name.c_str());
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        close(file);
+        if(mapping == MAP_FAILED)
+        {
+            unlink(temporary_name.c_str());
+            return false;
+        }
+
+        tt_file_header* header = (tt_file_header*)mapping;
+        std::copy(TT_FILE_MAGIC, TT_FILE_MAGIC + 8, header->magic);
+        header->version = TT_FILE_VERSION;
+        header->bucket_size = sizeof(tt_bucket);
+        header->bucket_count = bucket_mask + 1;
+        header->zobrist_check = zobrist_check;
+        header->generation = generation;
+        std::memcpy((char*)mapping + sizeof(tt_file_header), (const void*)transposition_table, size_bytes());
+
+        bool written = msync(mapping, file_size, MS_SYNC) == 0;
+        munmap(mapping, file_size);
+        if(!written || rename(temporary_name.c_str(), file_name.c_str()) != 0)
+        {
+            unlink(temporary_name.c_str());
+            return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Replace the table by the one in a file. The file is mapped copy on write, so pages are only read in when
+    // the search touches them, and the file itself is left as it was. The table takes the size of the file.
+    // Returns false and keeps the current table if the file is missing or does not match.
+    bool load_file(const std::string& file_name, uint64_t zobrist_check)
+    {
+#ifndef _WIN32
+        int file = open(file_name.c_str(), O_RDONLY);
+        if(file < 0)
+            return false;
+
+        tt_file_header header = {};
+        struct stat file_stat;
+        bool valid = fstat(file, &file_stat) == 0
+            && pread(file, &header, sizeof(header), 0) == sizeof(header)
+            && std::string(header.magic, 8) == std::string(TT_FILE_MAGIC, 8)
+            && header.version == TT_FILE_VERSION
+            && header.bucket_size == sizeof(tt_bucket)
+            && header.bucket_count != 0 && (header.bucket_count & (header.bucket_count - 1)) == 0
+            && uint64_t(file_stat.st_size) == sizeof(tt_file_header) + header.bucket_count * sizeof(tt_bucket)
+            && header.zobrist_check == zobrist_check;
+        if(!valid)
+        {
+            close(file);
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+        close(file);
+        if(mapping == MAP_FAILED)
+            return false;
+
+        release();
+        mapped_memory = mapping;
+        mapped_size = file_stat.st_size;
+        transposition_table = (tt_bucket*)((char*)mapping + sizeof(tt_file_header));
+        bucket_mask = header.bucket_count - 1;
+        generation = header.generation & TT_GENERATION_MASK;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Use a table in a named POSIX shared memory segment, so every engine process on the host that attaches to
+    // the same name shares one table. The first process creates the segment, later ones must ask for the same size.
+    // The lockless entries are safe between processes just like between threads. The segment stays until it is
+    // removed, e.g. rm /dev/shm/<name>. Returns false and keeps the current table if the segment can not be used.
+    bool attach_shared(const std::string& name, int size_mb, uint64_t zobrist_check)
+    {
+#ifndef _WIN32
+        std::string segment_name = !name.empty() && name[0] == '/' ? name : "/" + name;
+        uint64_t bucket_count = round_bucket_count(size_mb);
+        size_t segment_size = sizeof(tt_shared_header) + bucket_count * sizeof(tt_bucket);
+
+        // Exactly one process creates the segment, its pages start zeroed which is an empty table.
+        bool created = true;
+        int segment = shm_open(segment_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(segment < 0 && errno == EEXIST)
+        {
+            created = false;
+            segment = shm_open(segment_name.c_str(), O_RDWR, 0600);
+        }
+        if(segment < 0)
+            return false;
+
+        if(created && ftruncate(segment, segment_size) != 0)
+        {
+            close(segment);
+            shm_unlink(segment_name.c_str());
+            return false;
+        }
+
+        // The creator may not have sized the segment yet.
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TT_SHARED_WAIT_MS);
+        struct stat segment_stat;
+        while(!created && fstat(segment, &segment_stat) == 0 && segment_stat.st_size == 0 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if(!created && (fstat(segment, &segment_stat) != 0 || uint64_t(segment_stat.st_size) != segment_size))
+        {
+            close(segment);
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment, 0);
+        close(segment);
+        if(mapping == MAP_FAILED)
+            return false;
+
+        tt_shared_header* header = (tt_shared_header*)mapping;
+        if(created)
+        {
+            header->version = TT_FILE_VERSION;
+            header->bucket_size = sizeof(tt_bucket);
+            header->bucket_count = bucket_count;
+            header->zobrist_check = zobrist_check;
+            header->ready.store(TT_SHARED_READY, std::memory_order_release);
+        }
+        else
+        {
+            while(header->ready.load(std::memory_order_acquire) != TT_SHARED_READY && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            bool valid = header->ready.load(std::memory_order_acquire) == TT_SHARED_READY
+                && header->version == TT_FILE_VERSION
+                && header->bucket_size == sizeof(tt_bucket)
+                && header->bucket_count == bucket_count
+                && header->zobrist_check == zobrist_check;
+            if(!valid)
+            {
+                munmap(mapping, segment_size);
+                return false;
+            }
+        }
+
+        release();
+        mapped_memory = mapping;
+        mapped_size = segment_size;
+        transposition_table = (tt_bucket*)((char*)mapping + sizeof(tt_shared_header));
+        bucket_mask = bucket_count - 1;
+        shared_header = header;
+        created_shared = created;
+        generation = header->generation.load(std::memory_order_relaxed) & TT_GENERATION_MASK;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Whether the table lives in shared memory.
+    bool is_shared() const
+    {
+        return shared_header != nullptr;
     }
 
-    int read_hash_entry(int alpha, int beta, int depth, uint64_t key)
+    // Whether this process created the shared memory segment.
+    bool created_shared_segment() const
     {
-        tt* hash_entry = &transposition_table[key % hash_table_size];
+        return shared_header != nullptr && created_shared;
+    }
+
+    // Start a new search in O(1). Entries of older searches stay usable, but are replaced first.
+    void new_search()
+    {
+        if(shared_header != nullptr)
+            generation = (shared_header->generation.fetch_add(1, std::memory_order_relaxed) + 1) & TT_GENERATION_MASK;
+        else
+            generation = (generation + 1) & TT_GENERATION_MASK;
+    }
 
-        // Check if position is correct.
-        if(hash_entry->key != no_hash_entry && hash_entry->key == key)
+    // Start loading the bucket of a key into the cache. Issued right after a move is made, so the memory access
+    // overlaps with the move generation before the probe.
+    void prefetch(uint64_t key) const
+    {
+        __builtin_prefetch(&transposition_table[key & bucket_mask]);
+    }
+
+    // Read the score of a position. The best move is returned in hash_move even if the score can not be used, 0 if there is none.
+    int read_hash_entry(int alpha, int beta, int depth, int ply, uint64_t key, uint16_t& hash_move)
+    {
+        tt_bucket* bucket = &transposition_table[key & bucket_mask];
+
+        for(int i = 0; i < TT_BUCKET_SIZE; i++)
         {
+            uint64_t data = bucket->data[i].load(std::memory_order_relaxed);
+
+            // Check if position is correct.
+            if(!entry_matches(bucket->keys[i].load(std::memory_order_relaxed), data, key))
+                continue;
+
+            int entry_score = score_from_table(int16_t(data >> 16), ply);
+            int entry_depth = (data >> 32) & 0xFF;
+            int entry_flags = (data >> 40) & 0x3;
+            hash_move = data & 0xFFFF;
+
             // Make sure our depth is correct.
-            if(hash_entry->depth >= depth)
+            if(entry_depth >= depth)
             {
-                if(hash_entry->flags == hashfEXACT)
+                if(entry_flags == hashfEXACT)
                 {
-                    return hash_entry->score;
+                    return entry_score;
                 }
-                if(hash_entry->flags == hashfALPHA && hash_entry->score <= alpha)
+                if(entry_flags == hashfALPHA && entry_score <= alpha)
                 {
                     return alpha;
                 }
-                if(hash_entry->flags == hashfBETA && hash_entry->score >= beta)
+                if(entry_flags == hashfBETA && entry_score >= beta)
                 {
                     return beta;
                 }
             }
+            break;
         }
         
         // Does not exist.
         return no_hash_entry;
     }
 
-    int get_entry_nodes(int depth, uint64_t key)
+    // Store hash entry in the table. The same position is overwritten unless the stored entry is a deeper bound of this search.
+    // Otherwise the entry with the lowest depth is replaced, where every search of age counts as TT_AGE_WEIGHT plies less.
+    void insert_hash(int depth, int score, int hash_flag, int ply, uint64_t key, uint16_t move)
     {
-        tt* hash_entry = &transposition_table[key % hash_table_size + depth];
+        tt_bucket* bucket = &transposition_table[key & bucket_mask];
+        uint16_t key_check = key >> 48;
 
-        // Check if position is correct.
-        if(hash_entry->key != no_hash_entry && hash_entry->depth == depth)
+        int replace = 0;
+        int replace_value = INT32_MAX;
+        for(int i = 0; i < TT_BUCKET_SIZE; i++)
         {
-            return hash_entry->sub_nodes;
+            uint64_t data = bucket->data[i].load(std::memory_order_relaxed);
+            if(data == 0)
+            {
+                replace = i;
+                break;
+            }
+
+            int entry_depth = (data >> 32) & 0xFF;
+            int entry_generation = (data >> 42) & TT_GENERATION_MASK;
+            if(entry_matches(bucket->keys[i].load(std::memory_order_relaxed), data, key))
+            {
+                if(hash_flag != hashfEXACT && entry_generation == generation && entry_depth > depth + TT_KEEP_DEPTH)
+                    return;
+
+                // A search without a best move keeps the move of the earlier one.
+                if(move == 0)
+                    move = data & 0xFFFF;
+                replace = i;
+                break;
+            }
+
+            int age = (generation - entry_generation) & TT_GENERATION_MASK;
+            int value = entry_depth - TT_AGE_WEIGHT * age;
+            if(value < replace_value)
+            {
+                replace = i;
+                replace_value = value;
+            }
         }
-        
-        // Does not exist.
-        return no_hash_entry;
+
+        uint64_t data = uint64_t(move) | uint64_t(uint16_t(score_to_table(score, ply))) << 16 | uint64_t(depth & 0xFF) << 32
+            | uint64_t(hash_flag & 0x3) << 40 | uint64_t(generation) << 42 | 1ULL << 48 | (key >> 33 & 0x7FFF) << 49;
+
+        bucket->keys[replace].store(key_check ^ fold_data(data), std::memory_order_relaxed);
+        bucket->data[replace].store(data, std::memory_order_relaxed);
     }
 
-    // Store hash entry in the table.
-    void insert_hash(int depth, int score, int hash_flag, uint64_t key, int nodes)
+    // Mate scores count plies from the root, but the same position can be reached at another ply.
+    // The table stores them as plies from the position itself, and converts back on reading.
+    static int score_to_table(int score, int ply)
     {
-        tt* hash_entry = &transposition_table[key % hash_table_size + depth];
+        if(score > MATE_BOUND)
+            return score + ply;
+        if(score < -MATE_BOUND)
+            return score - ply;
+        return score;
+    }
 
-        hash_entry->depth = depth;
-        hash_entry->flags = hash_flag;
-        hash_entry->score = score;
-        hash_entry->key = key;
-        hash_entry->sub_nodes = nodes;
+    static int score_from_table(int score, int ply)
+    {
+        if(score > MATE_BOUND)
+            return score - ply;
+        if(score < -MATE_BOUND)
+            return score + ply;
+        return score;
     }
 
-    // clear table.
-    void clear_table()
+    // Clear table, split over thread_count threads. Only needed when the entries must be forgotten,
+    // e.g. for a new game. Between searches new_search() is enough, old entries are replaced first.
+    void clear_table(int thread_count = 1)
     {
-        for(int index = 0; index < transposition_table.size() + PERFT_DEPTH; index++)
+        for_each_slice(bucket_mask + 1, thread_count, [this](uint64_t begin, uint64_t end)
         {
-            transposition_table[index].key = no_hash_entry;
-            transposition_table[index].depth = 0;
-            transposition_table[index].flags = 0;
-            transposition_table[index].score = 0;
-        }
+            for(uint64_t index = begin; index < end; index++)
+            {
+                tt_bucket& bucket = transposition_table[index];
+                for(int i = 0; i < TT_BUCKET_SIZE; i++)
+                {
+                    bucket.keys[i].store(0, std::memory_order_relaxed);
+                    bucket.data[i].store(0, std::memory_order_relaxed);
+                }
+            }
+        });
+        generation = 0;
+    }
+
+    // Table size in bytes.
+    uint64_t size_bytes() const
+    {
+        return (bucket_mask + 1) * sizeof(tt_bucket);
+    }
+
+    // TT instance. Shared by all search threads.
+    tt_bucket* transposition_table = nullptr;
+
+    uint64_t bucket_mask = 0;
+
+    // Generation of the running search, stored in every entry it writes.
+    uint8_t generation = 0;
+
+private:
+
+    // Write the first entry of every page, split over thread_count threads. Rewriting the zero
+    // a fresh page already reads as is enough to make the kernel place it.
+    void first_touch(int thread_count)
+    {
+        uint64_t page_buckets = std::max<uint64_t>(4096 / sizeof(tt_bucket), 1);
+        uint64_t page_count = (bucket_mask + page_buckets) / page_buckets;
+
+        for_each_slice(page_count, thread_count, [this, page_buckets](uint64_t begin, uint64_t end)
+        {
+            for(uint64_t page = begin; page < end; page++)
+                transposition_table[page * page_buckets].data[0].store(0, std::memory_order_relaxed);
+        });
+    }
+
+    // Free the table memory.
+    void release()
+    {
+#ifndef _WIN32
+        if(mapped_memory != nullptr)
+            munmap(mapped_memory, mapped_size);
+#endif
+        memory_table = std::vector<tt_bucket>();
+        mapped_memory = nullptr;
+        mapped_size = 0;
+        transposition_table = nullptr;
+        bucket_mask = 0;
+        shared_header = nullptr;
+    }
+
+    // Largest power of two bucket count that fits in size_mb.
+    static uint64_t round_bucket_count(int size_mb)
+    {
+        uint64_t bucket_count = 1;
+        while(bucket_count * 2 * sizeof(tt_bucket) <= uint64_t(std::max(size_mb, 1)) * 1024 * 1024)
+            bucket_count *= 2;
+        return bucket_count;
     }
 
-    // TT instance.
-    std::vector<tt> transposition_table;
+    std::vector<tt_bucket> memory_table;
+
+    void* mapped_memory = nullptr;
+    size_t mapped_size = 0;
+
+    tt_shared_header* shared_header = nullptr;
+    bool created_shared = false;
+
+    // Fold the data word to 16 bits for the key check.
+    static uint16_t fold_data(uint64_t data)
+    {
+        return uint16_t(data ^ data >> 16 ^ data >> 32 ^ data >> 48);
+    }
+
+    // Whether a key check and data word that were read separately belong to key.
+    static bool entry_matches(uint16_t key_check, uint64_t data, uint64_t key)
+    {
+        return data != 0 && (key_check ^ fold_data(data)) == uint16_t(key >> 48) && (data >> 49) == (key >> 33 & 0x7FFF);
+    }
 };
 
 struct ZobristHash
@@ -102,7 +559,15 @@ struct ZobristHash
 
     uint64_t calculate_zobrist_key(Position* position, uint8_t current_player_sign);
 
-    void update_zobrist_hash(Move* move, Position* position, uint8_t current_player_sign, uint64_t& old_hash);
+    uint64_t key_set_check();
+
+    void update_zobrist_hash(Move* move, Position* position, uint64_t& old_hash);
+
+    void update_zobrist_hash_null(Move* move, Position* position, uint64_t& old_hash);
+
+    uint64_t calculate_pawn_key(Position* position);
+
+    void update_pawn_key(Move* move, uint64_t& pawn_key);
 
     uint64_t piece_keys[14][64];
     uint64_t enpassant_keys[64];
@@ -113,6 +113,29 @@ inline std::string make_chess_notation(int index)
 
 // ==============================================================================================
 
+// Convert a FEN piece letter to its bitboard index. Returns INVALID for anything else.
+inline uint8_t fen_letter_to_piece(char letter)
+{
+    switch(letter)
+    {
+        case 'K': return W_KING;
+        case 'Q': return W_QUEEN;
+        case 'R': return W_ROOK;
+        case 'B': return W_BISHOP;
+        case 'N': return W_KNIGHT;
+        case 'P': return W_PAWN;
+        case 'k': return B_KING;
+        case 'q': return B_QUEEN;
+        case 'r': return B_ROOK;
+        case 'b': return B_BISHOP;
+        case 'n': return B_KNIGHT;
+        case 'p': return B_PAWN;
+        default: return INVALID;
+    }
+}
+
+// ==============================================================================================
+
 inline uint64_t get_pawn_attack(bool is_black, uint8_t pos, uint64_t color_board, uint64_t occupancies)
 {
     return  is_black ? (1ULL << (63-pos-9) | 1ULL << (63-pos-7)) & (0xFFULL << (64-(pos - pos%8) - 16) & ~(color_board) & occupancies) 
@@ -121,6 +144,60 @@ inline uint64_t get_pawn_attack(bool is_black, uint8_t pos, uint64_t color_board
 
 // ==============================================================================================
 
+// Squares attacked by a pawn, regardless of what stands on them. Index is [is_black][square].
+constexpr static std::array<std::array<uint64_t, 64>, 2> PAWN_ATTACK_SQUARES = []() {
+    std::array<std::array<uint64_t, 64>, 2> values{};
+    for (int square = 0; square < 64; square++) {
+        int file = square % 8;
+        // White pawns attack towards square 0, black pawns towards square 63.
+        if (square >= 8 && file != 0) values[0][square] |= 1ULL << (63 - (square - 9));
+        if (square >= 8 && file != 7) values[0][square] |= 1ULL << (63 - (square - 7));
+        if (square < 56 && file != 0) values[1][square] |= 1ULL << (63 - (square + 7));
+        if (square < 56 && file != 7) values[1][square] |= 1ULL << (63 - (square + 9));
+    }
+    return values;
+}();
+
+// ==============================================================================================
+
+// Squares in front of a pawn on its own and the adjacent files. A pawn without enemy pawns there is passed. Index is [is_black][square].
+constexpr static std::array<std::array<uint64_t, 64>, 2> PASSED_PAWN_MASKS = []() {
+    std::array<std::array<uint64_t, 64>, 2> values{};
+    for (int square = 0; square < 64; square++) {
+        int file = square % 8;
+        for (int other = 0; other < 64; other++) {
+            int file_distance = other % 8 - file;
+            if (file_distance < -1 || file_distance > 1)
+                continue;
+            if (other / 8 < square / 8) values[0][square] |= 1ULL << (63 - other);
+            if (other / 8 > square / 8) values[1][square] |= 1ULL << (63 - other);
+        }
+    }
+    return values;
+}();
+
+// Squares a pawn can attack while it advances: the adjacent files in front of it. Index is [is_black][square].
+constexpr static std::array<std::array<uint64_t, 64>, 2> PAWN_ATTACK_SPANS = []() {
+    std::array<std::array<uint64_t, 64>, 2> values{};
+    for (int square = 0; square < 64; square++) {
+        for (int color = 0; color < 2; color++)
+            values[color][square] = PASSED_PAWN_MASKS[color][square] & ~(0x0101010101010101ULL << (7 - square % 8));
+    }
+    return values;
+}();
+
+// Squares of the adjacent files of a file.
+constexpr static std::array<uint64_t, 8> ADJACENT_FILES = []() {
+    std::array<uint64_t, 8> values{};
+    for (int file = 0; file < 8; file++) {
+        if (file > 0) values[file] |= 0x0101010101010101ULL << (7 - (file - 1));
+        if (file < 7) values[file] |= 0x0101010101010101ULL << (7 - (file + 1));
+    }
+    return values;
+}();
+
+// ==============================================================================================
+
 inline int chess_notation_to_index(const std::string& notation)
 {
     if (notation.length() != 2)
@@ -2,12 +2,12 @@
 
 void ZobristHash::init_zobrist_keys()
 {
-    std::random_device rd;
-    std::mt19937_64 gen(rd());
+    // Fixed seed, the perft cache file stores keys of earlier runs.
+    std::mt19937_64 gen(ZOBRIST_SEED);
     std::uniform_int_distribution<uint64_t> dis;
 
     // // Pieces.
-    for (uint8_t piece = 0b0; piece <= 0b1110; piece++)
+    for (uint8_t piece = 0b0; piece < 12; piece++)
     {
         // Squares.
         for(int square = 0; square < 64; square++)
@@ -34,6 +34,22 @@ void ZobristHash::init_zobrist_keys()
     }
 }
 
+// Fingerprint of the key set, stored with keys that are written to files.
+uint64_t ZobristHash::key_set_check()
+{
+    uint64_t check = side_key;
+    for(uint8_t piece = 0b0; piece < 12; piece++)
+    {
+        for(int square = 0; square < 64; square++)
+            check = (check ^ piece_keys[piece][square]) * 0x100000001B3ULL;
+    }
+    for(int i = 0; i < 16; i++)
+        check = (check ^ castle_keys[i]) * 0x100000001B3ULL;
+    for(int file = 0; file < 8; file++)
+        check = (check ^ enpassant_keys[file]) * 0x100000001B3ULL;
+    return check;
+}
+
 uint64_t ZobristHash::calculate_zobrist_key(Position* position, uint8_t current_player_sign)
 {
     uint64_t key = 0b0;
@@ -41,12 +57,14 @@ uint64_t ZobristHash::calculate_zobrist_key(Position* position, uint8_t current_
     for (uint8_t i = 0b0; i < 64; i++)
     {
         uint8_t piece = position->get_piece(i);
-        key ^= piece_keys[piece][i];
+        if(piece != EMPTY)
+            key ^= piece_keys[piece][i];
     }
 
-    if(position->en_passant !=  0b11111111)
+    // The file is enough to tell en passant states apart, the other bits follow from the pawns on the board.
+    if(position->en_passant != 0b00000000)
     {
-        key ^= enpassant_keys[position->en_passant];
+        key ^= enpassant_keys[position->en_passant & 0b00000111];
     }
 
     key ^= castle_keys[position->casling_rights];
@@ -58,7 +76,90 @@ uint64_t ZobristHash::calculate_zobrist_key(Position* position, uint8_t current_
     return key;
 }
 
-void ZobristHash::update_zobrist_hash(Move* move, Position* position, uint8_t current_player_sign, uint64_t& old_hash)
+// Update the key of the position before a move to the key after it. Called after the move is done on the position,
+// so the new castling rights and en passant status can be read from it. The player at turn changes with every move.
+void ZobristHash::update_zobrist_hash(Move* move, Position* position, uint64_t& old_hash)
+{
+    uint8_t moved_piece = move->moving_piece;
+    bool is_black = moved_piece > 5;
+    uint8_t placed_piece = move->promotion > 0 ? move->promotion + 6 * is_black : moved_piece;
+
+    old_hash ^= piece_keys[moved_piece][move->start_location];
+    old_hash ^= piece_keys[placed_piece][move->end_location];
+
+    // Captured piece. En passant takes the pawn next to the start square.
+    if(move->move_takes_an_passant)
+        old_hash ^= piece_keys[W_PAWN + 6 * !is_black][move->start_location / 8 * 8 + move->end_location % 8];
+    else if(move->captured_piece < 12)
+        old_hash ^= piece_keys[move->captured_piece][move->end_location];
+
+    // Castling also moves the rook.
+    if(move->special_cases >= 1 && move->special_cases <= 4)
+    {
+        static const uint8_t rook_squares[4][2] = {{63, 61}, {56, 59}, {7, 5}, {0, 3}};
+        const uint8_t* rook_move = rook_squares[move->special_cases - 1];
+        old_hash ^= piece_keys[W_ROOK + 6 * is_black][rook_move[0]] ^ piece_keys[W_ROOK + 6 * is_black][rook_move[1]];
+    }
+
+    if(move->previous_en_passant != 0b00000000)
+        old_hash ^= enpassant_keys[move->previous_en_passant & 0b00000111];
+    if(position->en_passant != 0b00000000)
+        old_hash ^= enpassant_keys[position->en_passant & 0b00000111];
+
+    old_hash ^= castle_keys[move->previous_castling_rights] ^ castle_keys[position->casling_rights];
+    old_hash ^= side_key;
+}
+
+// ==============================================================================================
+
+// Update the key for a null move: only the player at turn and the en passant status change.
+void ZobristHash::update_zobrist_hash_null(Move* move, Position* position, uint64_t& old_hash)
+{
+    if(move->previous_en_passant != 0b00000000)
+        old_hash ^= enpassant_keys[move->previous_en_passant & 0b00000111];
+    if(position->en_passant != 0b00000000)
+        old_hash ^= enpassant_keys[position->en_passant & 0b00000111];
+
+    old_hash ^= side_key;
+}
+
+// ==============================================================================================
+
+// Key of the pawns only, the index of the pawn hash table.
+uint64_t ZobristHash::calculate_pawn_key(Position* position)
+{
+    uint64_t key = 0b0;
+
+    for(uint8_t piece : {W_PAWN, B_PAWN})
+    {
+        uint64_t pawns = position->bit_boards[piece];
+        while(pawns)
+        {
+            int square = find_bit_position(pawns);
+            key ^= piece_keys[piece][square];
+            pawns &= pawns - 1;
+        }
+    }
+    return key;
+}
+
+// ==============================================================================================
+
+// Update the pawn key along a move. Only pawn moves, promotions and pawn captures change it.
+void ZobristHash::update_pawn_key(Move* move, uint64_t& pawn_key)
 {
+    uint8_t moved_piece = move->moving_piece;
+    bool is_black = moved_piece > 5;
 
-}
\ No newline at end of file
+    if(moved_piece % 6 == W_PAWN)
+    {
+        pawn_key ^= piece_keys[moved_piece][move->start_location];
+        if(move->promotion == 0)
+            pawn_key ^= piece_keys[moved_piece][move->end_location];
+    }
+
+    if(move->move_takes_an_passant)
+        pawn_key ^= piece_keys[W_PAWN + 6 * !is_black][move->start_location / 8 * 8 + move->end_location % 8];
+    else if(move->captured_piece < 12 && move->captured_piece % 6 == W_PAWN)
+        pawn_key ^= piece_keys[move->captured_piece][move->end_location];
+}